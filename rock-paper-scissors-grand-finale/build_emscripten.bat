@@ -4,4 +4,4 @@ mkdir ..\out\emscripten
 emcc -O3 -o ../out/emscripten/index.html^
  -sWASM=1 -sUSE_SDL=2 -sUSE_SDL_IMAGE=2 -sSDL2_IMAGE_FORMATS="[""png""]" -sUSE_SDL_TTF=2 -sUSE_SDL_MIXER=2^
  --preload-file entities.png --preload-file rock.wav --preload-file paper.wav --preload-file scissors.wav^
- src/Game.cpp src/main.cpp src/imgui/imgui.cpp src/imgui/imgui_demo.cpp src/imgui/imgui_draw.cpp src/imgui/imgui_impl_sdl2.cpp src/imgui/imgui_impl_sdlrenderer2.cpp src/imgui/imgui_tables.cpp src/imgui/imgui_widgets.cpp
\ No newline at end of file
+ src/Game.cpp src/main.cpp src/EventLog.cpp src/Trajectory.cpp src/Export.cpp src/AsyncFileWriter.cpp src/SpriteBatch.cpp src/DensityRenderer.cpp src/MessageQueue.cpp src/TripleBuffer.cpp src/TiledBruteForce.cpp src/SpatialBackend.cpp src/FlowField.cpp src/JobSystem.cpp src/Kernels.cpp src/Morton.cpp src/KdTree.cpp src/Quadtree.cpp src/SpatialGrid.cpp src/Histogram.cpp src/Benchmark.cpp src/Profiler.cpp src/imgui/imgui.cpp src/imgui/imgui_demo.cpp src/imgui/imgui_draw.cpp src/imgui/imgui_impl_sdl2.cpp src/imgui/imgui_impl_sdlrenderer2.cpp src/imgui/imgui_tables.cpp src/imgui/imgui_widgets.cpp
\ No newline at end of file
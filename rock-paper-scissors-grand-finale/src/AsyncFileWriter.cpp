@@ -0,0 +1,110 @@
+#include "AsyncFileWriter.h"
+
+#include <stdlib.h>
+
+static double now() {
+	return (double)SDL_GetPerformanceCounter() / (double)SDL_GetPerformanceFrequency();
+}
+
+static int writer_thread(void* data) {
+	AsyncFileWriter* w = (AsyncFileWriter*) data;
+	int index = 0;
+
+	for (;;) {
+		SDL_SemWait(w->filled);
+		if (w->quit) break;
+
+		if (fwrite(w->buffers[index], 1, w->sizes[index], w->file) != w->sizes[index]) {
+			w->failed = true;
+		}
+		index ^= 1;
+		SDL_SemPost(w->empty);
+	}
+
+	return 0;
+}
+
+bool AsyncFileWriter::Open(const char* path, size_t _capacity) {
+	thread = nullptr;
+	filled = nullptr;
+	empty = nullptr;
+	current = 0;
+	quit = false;
+	failed = false;
+	bytes = 0;
+	wait_time = 0.0;
+
+	file = fopen(path, "wb");
+	if (!file) {
+		SDL_Log("Couldn't open \"%s\" for writing.", path);
+		return false;
+	}
+
+	capacity = _capacity;
+	buffers[0] = (Uint8*) malloc(capacity);
+	buffers[1] = (Uint8*) malloc(capacity);
+	if (!buffers[0] || !buffers[1]) {
+		SDL_Log("Out of memory.");
+		exit(1);
+	}
+
+	filled = SDL_CreateSemaphore(0);
+	empty = SDL_CreateSemaphore(2);
+	if (filled && empty) {
+		thread = SDL_CreateThread(writer_thread, "File Writer", this);
+	}
+	if (!thread) {
+		SDL_Log("Couldn't start the file writer, writing inline: %s", SDL_GetError());
+	}
+
+	return true;
+}
+
+Uint8* AsyncFileWriter::Begin() {
+	if (thread) {
+		double t = now();
+		SDL_SemWait(empty);
+		wait_time += now() - t;
+	}
+	return buffers[current];
+}
+
+void AsyncFileWriter::Submit(size_t size) {
+	sizes[current] = size;
+	bytes += size;
+
+	if (thread) {
+		SDL_SemPost(filled);
+	} else if (fwrite(buffers[current], 1, size, file) != size) {
+		failed = true;
+	}
+	current ^= 1;
+}
+
+bool AsyncFileWriter::Close() {
+	if (thread) {
+		// Both buffers back means both were written.
+		SDL_SemWait(empty);
+		SDL_SemWait(empty);
+		quit = true;
+		SDL_SemPost(filled);
+		SDL_WaitThread(thread, nullptr);
+	}
+	if (filled) SDL_DestroySemaphore(filled);
+	if (empty) SDL_DestroySemaphore(empty);
+
+	if (fclose(file) != 0) {
+		failed = true;
+	}
+	free(buffers[0]);
+	free(buffers[1]);
+
+	bool ok = !failed;
+	thread = nullptr;
+	filled = nullptr;
+	empty = nullptr;
+	file = nullptr;
+	buffers[0] = nullptr;
+	buffers[1] = nullptr;
+	return ok;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <SDL.h>
+#include <atomic>
+#include <stdio.h>
+
+// Streams a file from a background thread through two buffers: the caller
+// fills one while the other is being written, and only waits when the disk
+// falls a whole buffer behind.
+//
+//     Uint8* data = writer.Begin();   // blocks until a buffer is free
+//     ... fill up to `capacity` bytes ...
+//     writer.Submit(size);
+struct AsyncFileWriter {
+	FILE* file;
+	SDL_Thread* thread;
+	SDL_sem* filled;  // buffers waiting to be written
+	SDL_sem* empty;   // buffers the caller may fill
+	Uint8* buffers[2];
+	size_t sizes[2];
+	size_t capacity;
+	int current;      // caller's next buffer
+	std::atomic<bool> quit;
+	std::atomic<bool> failed;
+
+	// Caller side only.
+	Uint64 bytes;
+	double wait_time;  // seconds spent in Begin() waiting for the disk
+
+	bool Open(const char* path, size_t _capacity);
+	Uint8* Begin();
+	void Submit(size_t size);
+
+	// Waits for everything submitted to be written. Returns false if any
+	// write failed.
+	bool Close();
+};
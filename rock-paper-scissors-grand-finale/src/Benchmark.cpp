@@ -0,0 +1,351 @@
+#include "Benchmark.h"
+
+#include "Game.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Ticks before the target cache check starts counting, and how many it counts.
+#define BENCH_TARGET_CACHE_WARMUP 30
+#define BENCH_TARGET_CACHE_TICKS 60
+
+static void write_run(FILE* f, Game* game, const char* name, int ticks) {
+	Profiler* p = &game->profiler;
+	ProfilerThread* t = &p->threads[0];
+	double to_ms = 1000.0 / (double)SDL_GetPerformanceFrequency();
+	int available = p->hw_counters_available;
+
+	fprintf(f, "{\"name\":\"%s\",\"entities\":%d,\"ticks\":%d,\"zones\":{", name, game->init_entity_count, ticks);
+
+	int zone_count = t->zone_count.load();
+	for (int i = 0; i < zone_count; i++) {
+		ProfileZoneStats* z = &t->zones[i];
+
+		if (i > 0) fprintf(f, ",");
+		fprintf(f, "\n\t\t\"%s\":{\"ms_per_tick\":%.6f,\"calls_per_tick\":%.3f",
+				z->name,
+				(double)z->time.load() * to_ms / (double)ticks,
+				(double)z->calls.load() / (double)ticks);
+
+		for (int k = 0; k < PERF_COUNTER_COUNT; k++) {
+			if (available & (1 << k)) {
+				fprintf(f, ",\"%s\":%.1f", perf_counter_names[k], (double)z->counters[k].load() / (double)ticks);
+			}
+		}
+		if ((available & (1 << PERF_CYCLES)) && (available & (1 << PERF_INSTRUCTIONS)) && z->counters[PERF_CYCLES].load() > 0) {
+			fprintf(f, ",\"ipc\":%.3f", (double)z->counters[PERF_INSTRUCTIONS].load() / (double)z->counters[PERF_CYCLES].load());
+		}
+		fprintf(f, "}");
+	}
+
+	fprintf(f, "},\n\t\"counters\":{");
+
+	int counter_count = t->counter_count.load();
+	for (int i = 0; i < counter_count; i++) {
+		ProfileCounter* c = &t->counters[i];
+
+		if (i > 0) fprintf(f, ",");
+		if (c->ratio) {
+			double total = c->total.load();
+			fprintf(f, "\n\t\t\"%s\":%.3f", c->name, (total > 0.0) ? c->value.load() / total : 0.0);
+		} else {
+			fprintf(f, "\n\t\t\"%s\":%.3f", c->name, c->value.load() / (double)ticks);
+		}
+	}
+
+	fprintf(f, "}}");
+}
+
+// Fixed seed (the default xoshiro state) so runs are comparable.
+static Game* create_game(const BenchmarkOptions& options) {
+	Game* game = new Game{};
+	game->profiler.Init();
+	game->profiler.hw_counters = options.hw_counters;
+	game->jobs.Init(&game->profiler, -1);
+	register_spatial_backends(game);
+	game->init_entity_count = options.entity_count;
+	game->Reset();
+	return game;
+}
+
+static void destroy_game(Game* game) {
+	game->FreeWorld();
+	game->jobs.Quit();
+	game->profiler.Quit();
+	delete game;
+}
+
+static const ProfileCounter* find_counter(Game* game, const char* name) {
+	ProfilerThread* t = &game->profiler.threads[0];
+	int counter_count = t->counter_count.load();
+	for (int i = 0; i < counter_count; i++) {
+		if (strcmp(t->counters[i].name, name) == 0) {
+			return &t->counters[i];
+		}
+	}
+	return nullptr;
+}
+
+// By the middle of a game the target cache should settle part of the
+// entities without a search. A hit rate of zero means conversions are
+// invalidating every bound again.
+static bool check_target_cache(const BenchmarkOptions& options, float delta) {
+	Game* game = create_game(options);
+
+	for (int i = 0; i < BENCH_TARGET_CACHE_WARMUP; i++) {
+		game->Update(delta);
+	}
+
+	const ProfileCounter* c = find_counter(game, "Target Cache Hit Rate");
+	double hits = c ? c->value.load() : 0.0;
+	double total = c ? c->total.load() : 0.0;
+	for (int i = 0; i < BENCH_TARGET_CACHE_TICKS; i++) {
+		game->Update(delta);
+	}
+	c = find_counter(game, "Target Cache Hit Rate");
+	hits = c ? c->value.load() - hits : 0.0;
+	total = c ? c->total.load() - total : 0.0;
+
+	double rate = (total > 0.0) ? hits / total : 0.0;
+	SDL_Log("Benchmark: target cache hit rate %.1f%% mid-game.", rate * 100.0);
+	destroy_game(game);
+
+	return rate > 0.0;
+}
+
+static float gaussian(xoshiro256plusplus* random) {
+	float u = random->range(1e-7f, 1.0f);
+	float v = random->range(0.0f, 1.0f);
+	return sqrtf(-2.0f * logf(u)) * cosf(2.0f * 3.14159265f * v);
+}
+
+// Late-game look: a few dense swarms, each mostly one type.
+static void make_clustered(Game* game) {
+	const int clusters = 16;
+	float cx[clusters];
+	float cy[clusters];
+	EntityType ct[clusters];
+	for (int c = 0; c < clusters; c++) {
+		cx[c] = game->random.range(0.0f, game->map_w);
+		cy[c] = game->random.range(0.0f, game->map_h);
+		ct[c] = (EntityType) (game->random.next() % 3);
+	}
+
+	for (int i = 0; i < game->entity_count; i++) {
+		Entity* e = &game->entities[i];
+		int c = (int) (game->random.next() % clusters);
+		e->x = cx[c] + gaussian(&game->random) * 60.0f;
+		e->y = cy[c] + gaussian(&game->random) * 60.0f;
+		e->type = (game->random.next() % 100 < 85) ? ct[c] : (EntityType) (game->random.next() % 3);
+	}
+
+	game->ReorderEntities();
+}
+
+// Float vs packed layout on a plain brute force scan, which is bound by
+// memory bandwidth at these sizes. Runs on bare arrays, a full Game would
+// need several times the memory.
+static void write_layout_runs(FILE* f, int queries) {
+	const int sizes[] = {1'000'000, 10'000'000};
+	const char* layouts[] = {"float", "packed_scalar", "packed"};
+	double to_s = 1.0 / (double)SDL_GetPerformanceFrequency();
+
+	for (int s = 0; s < 2; s++) {
+		int count = sizes[s];
+		Entity* entities = (Entity*) malloc(count * sizeof(Entity));
+		PackedEntity* packed = (PackedEntity*) malloc(count * sizeof(PackedEntity));
+		if (!entities || !packed) {
+			SDL_Log("Benchmark: not enough memory for %d entities, skipping.", count);
+			free(entities);
+			free(packed);
+			continue;
+		}
+
+		xoshiro256plusplus random{};
+		float map_size = sqrtf((float)count) * 28.0f;  // same density as the default map
+		for (int i = 0; i < count; i++) {
+			entities[i].x = random.range(0.0f, map_size);
+			entities[i].y = random.range(0.0f, map_size);
+			entities[i].type = (EntityType) (random.next() % 3);
+		}
+		PackedBounds bounds = pack_entities(entities, count, packed);
+
+		size_t bytes[] = {count * sizeof(Entity), count * sizeof(PackedEntity), count * sizeof(PackedEntity)};
+
+		fprintf(f, "%s\n\t{\"entities\":%d,\"queries\":%d", (s > 0) ? "," : "", count, queries);
+		for (int l = 0; l < 3; l++) {
+			// Same query points for every layout.
+			xoshiro256plusplus query_random = random;
+			Sint64 checksum = 0;
+			Uint64 begin = SDL_GetPerformanceCounter();
+			for (int q = 0; q < queries; q++) {
+				float px = query_random.range(0.0f, map_size);
+				float py = query_random.range(0.0f, map_size);
+				float best = INFINITY;
+				float second = INFINITY;
+				int index = -1;
+				if (l == 0) {
+					closest_in_range(entities, 0, count, px, py, &best, &second, &index);
+				} else if (l == 1) {
+					closest_in_range_packed_scalar(packed, bounds, 0, count, px, py, &best, &second, &index);
+				} else {
+					closest_in_range_packed(packed, bounds, 0, count, px, py, &best, &second, &index);
+				}
+				checksum += index;
+			}
+			double seconds = (double)(SDL_GetPerformanceCounter() - begin) * to_s;
+			double visits = (double)count * (double)queries;
+
+			fprintf(f, ",\n\t\t\"%s\":{\"bytes\":%llu,\"ns_per_entity\":%.4f,\"gb_per_s\":%.3f}",
+					layouts[l], (unsigned long long)bytes[l],
+					seconds * 1e9 / visits,
+					(double)bytes[l] * (double)queries / seconds / 1e9);
+			SDL_Log("Benchmark: layout/%d/%s %.4f ns per entity (checksum %lld).",
+					count, layouts[l], seconds * 1e9 / visits, (long long)checksum);
+		}
+		fprintf(f, "}");
+
+		free(entities);
+		free(packed);
+	}
+}
+
+static double zone_ms(Game* game, const char* name, int ticks) {
+	ProfilerThread* t = &game->profiler.threads[0];
+	int zone_count = t->zone_count.load();
+	for (int i = 0; i < zone_count; i++) {
+		if (strcmp(t->zones[i].name, name) == 0) {
+			return (double)t->zones[i].time.load() * 1000.0 / (double)SDL_GetPerformanceFrequency() / (double)ticks;
+		}
+	}
+	return 0.0;
+}
+
+// Targeting and collisions with full retargets every tick: the plain
+// brute force loops, the tiled pass, and the grid, to show where each one
+// stops paying off.
+static void write_crossover_runs(FILE* f, const BenchmarkOptions& options, float delta) {
+	const int sizes[] = {64, 128, 256, 512, 1'024, 2'048, 4'096, 8'192};
+	const char* variants[] = {"loops", "tiled", "grid"};
+
+	for (int s = 0; s < 8; s++) {
+		fprintf(f, "%s\n\t{\"entities\":%d,\"ticks\":%d", (s > 0) ? "," : "", sizes[s], options.crossover_ticks);
+
+		for (int v = 0; v < 3; v++) {
+			BenchmarkOptions o = options;
+			o.entity_count = sizes[s];
+			Game* game = create_game(o);
+			game->target_cache = false;
+			game->spatial_mode = (v == 2) ? SpatialMode::GRID : SpatialMode::BRUTE_FORCE;
+			game->tiled_brute_force = (v == 1);
+
+			for (int i = 0; i < options.crossover_ticks; i++) {
+				game->Update(delta);
+			}
+
+			double targeting = zone_ms(game, "Targeting", options.crossover_ticks);
+			double collisions = zone_ms(game, "Collisions", options.crossover_ticks);
+			double build = zone_ms(game, "Index Build", options.crossover_ticks);
+
+			fprintf(f, ",\n\t\t\"%s\":{\"index_ms\":%.4f,\"targeting_ms\":%.4f,\"collisions_ms\":%.4f,\"total_ms\":%.4f}",
+					variants[v], build, targeting, collisions, build + targeting + collisions);
+			SDL_Log("Benchmark: crossover/%d/%s %.4f ms per tick.", sizes[s], variants[v], build + targeting + collisions);
+
+			destroy_game(game);
+		}
+		fprintf(f, "}");
+	}
+}
+
+int RunBenchmark(const BenchmarkOptions& options) {
+	FILE* f = fopen(options.path, "wb");
+	if (!f) {
+		SDL_Log("Couldn't open \"%s\" for writing.", options.path);
+		return 1;
+	}
+
+	float delta = 60.0f / (float)GAME_FPS;
+	int available = 0;
+
+	fprintf(f, "{\n\t\"runs\":[\n\t");
+
+	{
+		Game* game = create_game(options);
+
+		for (int i = 0; i < options.ticks; i++) {
+			PROFILE_ZONE(&game->profiler, "Update");
+			game->Update(delta);
+		}
+
+		write_run(f, game, "update", options.ticks);
+		available |= game->profiler.hw_counters_available;
+		destroy_game(game);
+	}
+
+	bool target_cache_ok = check_target_cache(options, delta);
+	if (!target_cache_ok) {
+		SDL_Log("Benchmark: the target cache never hit.");
+	}
+
+	// Nearest-enemy queries for every entity against a frozen snapshot.
+	const char* distributions[] = {"uniform", "clustered"};
+	for (int d = 0; d < 2; d++) {
+		for (int m = 0; m < (int)SpatialMode::COUNT; m++) {
+			Game* game = create_game(options);
+			game->spatial_mode = (SpatialMode)m;
+			if (d == 1) {
+				make_clustered(game);
+			}
+
+			Sint64 checksum = 0;
+			for (int i = 0; i < options.query_ticks; i++) {
+				{
+					PROFILE_ZONE(&game->profiler, "Index Build");
+					game->BuildSpatialIndex();
+				}
+				{
+					PROFILE_ZONE(&game->profiler, "Query");
+					for (int j = 0; j < game->entity_count; j++) {
+						checksum += game->query_closest(&game->entities[j], INFINITY).index;
+					}
+				}
+			}
+
+			char name[64];
+			SDL_snprintf(name, sizeof(name), "nearest/%s/%s", distributions[d], game->backends[m].name);
+			fprintf(f, ",\n\t");
+			write_run(f, game, name, options.query_ticks);
+			available |= game->profiler.hw_counters_available;
+			SDL_Log("Benchmark: %s done (checksum %lld).", name, (long long)checksum);
+
+			destroy_game(game);
+		}
+	}
+
+	fprintf(f, "\n\t],\n\t\"layouts\":[");
+	if (options.layout_queries > 0) {
+		write_layout_runs(f, options.layout_queries);
+	}
+
+	fprintf(f, "\n\t],\n\t\"crossover\":[");
+	if (options.crossover_ticks > 0) {
+		write_crossover_runs(f, options, delta);
+	}
+
+	fprintf(f, "\n\t],\n\t\"hw_counters\":[");
+	bool first = true;
+	for (int k = 0; k < PERF_COUNTER_COUNT; k++) {
+		if (available & (1 << k)) {
+			fprintf(f, "%s\"%s\"", first ? "" : ",", perf_counter_names[k]);
+			first = false;
+		}
+	}
+	fprintf(f, "]\n}\n");
+	fclose(f);
+
+	SDL_Log("Benchmark: %d entities, %d ticks, wrote \"%s\".", options.entity_count, options.ticks, options.path);
+
+	return target_cache_ok ? 0 : 1;
+}
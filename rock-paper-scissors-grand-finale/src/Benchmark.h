@@ -0,0 +1,15 @@
+#pragma once
+
+struct BenchmarkOptions {
+	const char* path;
+	int entity_count = 5'000;
+	int ticks = 300;
+	int query_ticks = 30;
+	int layout_queries = 32;  // per world size for the layout comparison, 0 = skip
+	int crossover_ticks = 30; // per entity count for the tiled brute force comparison, 0 = skip
+	bool hw_counters;
+};
+
+// Runs the simulation without a window and writes per-zone timings (and
+// hardware counters, when available) as JSON. Returns the process exit code.
+int RunBenchmark(const BenchmarkOptions& options);
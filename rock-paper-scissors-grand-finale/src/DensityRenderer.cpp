@@ -0,0 +1,209 @@
+#include "DensityRenderer.h"
+
+#include "Game.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef KERNELS_SSE2
+#include <emmintrin.h>
+#endif
+
+struct DensityJob {
+	DensityRenderer* density;
+	const Snapshot* snap;
+	float alpha;
+	float camera_x;
+	float camera_y;
+	float zoom;
+	float knee;
+	Uint8* pixels;
+	int pitch;
+};
+
+static void bin_job(void* user, int begin, int end) {
+	DensityJob* job = (DensityJob*) user;
+	DensityRenderer* d = job->density;
+	const Snapshot* snap = job->snap;
+
+	for (int i = begin; i < end; i++) {
+		const Entity* e = &snap->entities[i];
+		float x = snap->prev[i * 2 + 0] + (e->x - snap->prev[i * 2 + 0]) * job->alpha;
+		float y = snap->prev[i * 2 + 1] + (e->y - snap->prev[i * 2 + 1]) * job->alpha;
+		float sx = floorf((x - job->camera_x) * job->zoom);
+		float sy = floorf((y - job->camera_y) * job->zoom);
+
+		if (sx < 0.0f || sy < 0.0f || sx >= (float)d->w || sy >= (float)d->h) {
+			d->keys[i] = DENSITY_OFFSCREEN;
+			continue;
+		}
+
+		Uint32 channel = 2 - (Uint32)e->type;
+		d->keys[i] = (channel << 30) | ((Uint32)sy * (Uint32)d->w + (Uint32)sx);
+	}
+}
+
+static void tone_map_row(const Uint16* counts, Uint32* out, int w, float knee) {
+	int x = 0;
+
+#ifdef KERNELS_SSE2
+	// 4 pixels at a time: 255 * c / (c + knee) for all 16 channels.
+	__m128 scale = _mm_set1_ps(255.0f);
+	__m128 k = _mm_set1_ps(knee);
+	__m128i zero = _mm_setzero_si128();
+	__m128i opaque = _mm_set1_epi32((int)0xFF000000);
+
+	for (; x + 4 <= w; x += 4) {
+		__m128i c01 = _mm_loadu_si128((const __m128i*) &counts[x * 4]);
+		__m128i c23 = _mm_loadu_si128((const __m128i*) &counts[x * 4 + 8]);
+
+		__m128 f0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(c01, zero));
+		__m128 f1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(c01, zero));
+		__m128 f2 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(c23, zero));
+		__m128 f3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(c23, zero));
+
+		__m128i v0 = _mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(f0, scale), _mm_add_ps(f0, k)));
+		__m128i v1 = _mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(f1, scale), _mm_add_ps(f1, k)));
+		__m128i v2 = _mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(f2, scale), _mm_add_ps(f2, k)));
+		__m128i v3 = _mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(f3, scale), _mm_add_ps(f3, k)));
+
+		__m128i bytes = _mm_packus_epi16(_mm_packs_epi32(v0, v1), _mm_packs_epi32(v2, v3));
+		_mm_storeu_si128((__m128i*) &out[x], _mm_or_si128(bytes, opaque));
+	}
+#endif
+
+	for (; x < w; x++) {
+		Uint32 pixel = 0xFF000000;
+		for (int c = 0; c < 3; c++) {
+			float f = (float)counts[x * 4 + c];
+			Uint32 v = (Uint32)(255.0f * f / (f + knee));
+			pixel |= v << (c * 8);
+		}
+		out[x] = pixel;
+	}
+}
+
+static void band_job(void* user, int begin, int end) {
+	DensityJob* job = (DensityJob*) user;
+	DensityRenderer* d = job->density;
+
+	for (int band = begin; band < end; band++) {
+		int y0 = band * DENSITY_BAND_HEIGHT;
+		int y1 = SDL_min(y0 + DENSITY_BAND_HEIGHT, d->h);
+		Uint16* counts = &d->counts[(size_t)y0 * d->w * 4];
+		memset(counts, 0, (size_t)(y1 - y0) * d->w * 4 * sizeof(Uint16));
+
+		for (int k = d->band_start[band]; k < d->band_start[band + 1]; k++) {
+			Uint32 key = d->sorted[k];
+			Uint16* c = &d->counts[(size_t)(key & 0x3FFFFFFF) * 4 + (key >> 30)];
+			if (*c != 0xFFFF) (*c)++;
+		}
+
+		for (int y = y0; y < y1; y++) {
+			tone_map_row(&d->counts[(size_t)y * d->w * 4], (Uint32*) (job->pixels + (size_t)y * job->pitch), d->w, job->knee);
+		}
+	}
+}
+
+void DensityRenderer::Draw(SDL_Renderer* renderer, JobSystem* jobs, const Snapshot* snap, float alpha,
+						   float camera_x, float camera_y, float zoom, float knee) {
+	int out_w;
+	int out_h;
+	SDL_GetRendererOutputSize(renderer, &out_w, &out_h);
+	if (out_w <= 0 || out_h <= 0) return;
+
+	if (out_w != w || out_h != h || !texture) {
+		if (texture) SDL_DestroyTexture(texture);
+		free(counts);
+		free(band_start);
+
+		w = out_w;
+		h = out_h;
+		band_count = (h + DENSITY_BAND_HEIGHT - 1) / DENSITY_BAND_HEIGHT;
+		texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, w, h);
+		counts = (Uint16*) malloc((size_t)w * h * 4 * sizeof(Uint16));
+		band_start = (int*) malloc((band_count + 1) * sizeof(int));
+		if (!counts || !band_start) {
+			SDL_Log("Out of memory.");
+			exit(1);
+		}
+		if (!texture) {
+			SDL_Log("Couldn't create the density texture: %s", SDL_GetError());
+			return;
+		}
+	}
+
+	if (snap->entity_count > entity_capacity) {
+		free(keys);
+		free(sorted);
+		entity_capacity = snap->entity_count;
+		keys = (Uint32*) malloc(entity_capacity * sizeof(Uint32));
+		sorted = (Uint32*) malloc(entity_capacity * sizeof(Uint32));
+		if (!keys || !sorted) {
+			SDL_Log("Out of memory.");
+			exit(1);
+		}
+	}
+
+	DensityJob job = {};
+	job.density = this;
+	job.snap = snap;
+	job.alpha = alpha;
+	job.camera_x = camera_x;
+	job.camera_y = camera_y;
+	job.zoom = zoom;
+	job.knee = SDL_max(knee, 0.01f);
+
+	jobs->ParallelFor("Density Bin", snap->entity_count, 4'096, bin_job, &job);
+
+	// Counting sort by band.
+	{
+		PROFILE_ZONE(jobs->profiler, "Density Sort");
+
+		Uint32 band_pixels = (Uint32)w * DENSITY_BAND_HEIGHT;
+		memset(band_start, 0, (band_count + 1) * sizeof(int));
+		for (int i = 0; i < snap->entity_count; i++) {
+			if (keys[i] != DENSITY_OFFSCREEN) {
+				band_start[(keys[i] & 0x3FFFFFFF) / band_pixels + 1]++;
+			}
+		}
+		for (int b = 0; b < band_count; b++) {
+			band_start[b + 1] += band_start[b];
+		}
+		for (int i = 0; i < snap->entity_count; i++) {
+			if (keys[i] != DENSITY_OFFSCREEN) {
+				int band = (keys[i] & 0x3FFFFFFF) / band_pixels;
+				sorted[band_start[band]++] = keys[i];
+			}
+		}
+		// The scatter moved every start to the next band's start.
+		for (int b = band_count; b > 0; b--) {
+			band_start[b] = band_start[b - 1];
+		}
+		band_start[0] = 0;
+	}
+
+	void* pixels;
+	int pitch;
+	if (SDL_LockTexture(texture, nullptr, &pixels, &pitch) != 0) {
+		SDL_Log("Couldn't lock the density texture: %s", SDL_GetError());
+		return;
+	}
+	job.pixels = (Uint8*) pixels;
+	job.pitch = pitch;
+
+	jobs->ParallelFor("Density Bands", band_count, 1, band_job, &job);
+
+	SDL_UnlockTexture(texture);
+	SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+}
+
+void DensityRenderer::Free() {
+	if (texture) SDL_DestroyTexture(texture);
+	free(counts);
+	free(keys);
+	free(sorted);
+	free(band_start);
+	*this = {};
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <SDL.h>
+
+struct Snapshot;
+struct JobSystem;
+
+#define DENSITY_BAND_HEIGHT 16        // screen rows per job
+#define DENSITY_OFFSCREEN 0xFFFFFFFFu
+
+// Draws entities as a density image instead of one sprite each, for when
+// there are too many of them or they're too small to see. Every entity adds
+// one to its pixel's count for its type; the counts are tone-mapped to a
+// color channel per type (rock red, paper green, scissors blue) and
+// uploaded into a streaming texture.
+//
+// Entities are first sorted into horizontal bands of the screen, so each
+// band is accumulated and tone-mapped by one job without atomics.
+struct DensityRenderer {
+	SDL_Texture* texture;
+	int w;
+	int h;
+	Uint16* counts;  // 4 per pixel in texture byte order: B, G, R, unused
+
+	Uint32* keys;    // per entity: pixel index with the channel in the top 2 bits, or DENSITY_OFFSCREEN
+	Uint32* sorted;  // visible keys grouped by band
+	int entity_capacity;
+	int* band_start; // band_count + 1
+	int band_count;
+
+	// `zoom` is screen pixels per world pixel. A pixel holding `knee`
+	// entities of one type is drawn at half brightness.
+	void Draw(SDL_Renderer* renderer, JobSystem* jobs, const Snapshot* snap, float alpha,
+			  float camera_x, float camera_y, float zoom, float knee);
+	void Free();
+};
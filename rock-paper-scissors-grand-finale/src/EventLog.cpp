@@ -0,0 +1,148 @@
+#include "EventLog.h"
+
+#include "Game.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "misc.h"
+
+#define EVENT_LOG_CHUNK_SIZE (sizeof(EventLogChunk) + EVENT_LOG_CHUNK_RECORDS * sizeof(ConversionEvent))
+
+static void begin_chunk(EventLog* log) {
+	Uint8* data = log->file.Begin();
+	log->chunk = (EventLogChunk*) data;
+	log->chunk->magic = EVENT_LOG_CHUNK_MAGIC;
+	log->chunk->record_count = 0;
+	log->records = (ConversionEvent*) (data + sizeof(EventLogChunk));
+}
+
+bool EventLog::Open(const char* _path, float map_w, float map_h) {
+	if (!file.Open(_path, EVENT_LOG_CHUNK_SIZE)) {
+		return false;
+	}
+
+	open = true;
+	SDL_strlcpy(path, _path, sizeof(path));
+	event_count = 0;
+
+	EventLogHeader header = {};
+	header.magic = EVENT_LOG_MAGIC;
+	header.version = EVENT_LOG_VERSION;
+	header.record_size = sizeof(ConversionEvent);
+	header.chunk_records = EVENT_LOG_CHUNK_RECORDS;
+	header.map_w = map_w;
+	header.map_h = map_h;
+	Uint8* data = file.Begin();
+	memcpy(data, &header, sizeof(header));
+	file.Submit(sizeof(header));
+
+	begin_chunk(this);
+	return true;
+}
+
+void EventLog::Flush() {
+	event_count += chunk->record_count;
+	file.Submit(sizeof(EventLogChunk) + chunk->record_count * sizeof(ConversionEvent));
+	begin_chunk(this);
+}
+
+void EventLog::Close() {
+	if (!open) return;
+
+	// An empty last chunk is just its header; readers skip it.
+	event_count += chunk->record_count;
+	file.Submit(sizeof(EventLogChunk) + chunk->record_count * sizeof(ConversionEvent));
+
+	double wait_time = file.wait_time;
+	Uint64 bytes = file.bytes;
+	if (!file.Close()) {
+		SDL_Log("Couldn't write \"%s\".", path);
+	}
+
+	SDL_Log("Logged %llu conversions to \"%s\": %.2f MB, %.1f ms waiting for the disk.",
+			(unsigned long long)event_count, path, (double)bytes / (1024.0 * 1024.0), wait_time * 1000.0);
+
+	open = false;
+	chunk = nullptr;
+	records = nullptr;
+}
+
+int RunEventsToCsv(const EventsToCsvOptions& options) {
+	const char* log_path = options.log_path;
+	const char* csv_path = options.csv_path;
+
+	FILE* in = fopen(log_path, "rb");
+	if (!in) {
+		SDL_Log("Couldn't open \"%s\".", log_path);
+		return 1;
+	}
+
+	EventLogHeader header;
+	if (fread(&header, sizeof(header), 1, in) != 1
+		|| header.magic != EVENT_LOG_MAGIC
+		|| header.version != EVENT_LOG_VERSION
+		|| header.record_size != sizeof(ConversionEvent)
+		|| header.chunk_records == 0) {
+		SDL_Log("\"%s\" isn't a conversion log.", log_path);
+		fclose(in);
+		return 1;
+	}
+
+	FILE* out = fopen(csv_path, "w");
+	if (!out) {
+		SDL_Log("Couldn't open \"%s\" for writing.", csv_path);
+		fclose(in);
+		return 1;
+	}
+
+	ConversionEvent* records = (ConversionEvent*) malloc(header.chunk_records * sizeof(ConversionEvent));
+	if (!records) {
+		SDL_Log("Out of memory.");
+		exit(1);
+	}
+
+	const char* type_names[] = {"rock", "paper", "scissors"};
+	auto type_name = [&](Uint8 t) {
+		return (t < ArrayLength(type_names)) ? type_names[t] : "?";
+	};
+
+	fprintf(out, "tick,predator,victim,x,y,predator_type,victim_type\n");
+
+	Uint64 count = 0;
+	int chunks = 0;
+	bool ok = true;
+	EventLogChunk chunk;
+	while (fread(&chunk, sizeof(chunk), 1, in) == 1) {
+		if (chunk.magic != EVENT_LOG_CHUNK_MAGIC || chunk.record_count > header.chunk_records) {
+			ok = false;
+			break;
+		}
+		if (fread(records, sizeof(ConversionEvent), chunk.record_count, in) != chunk.record_count) {
+			ok = false;
+			break;
+		}
+
+		for (Uint32 k = 0; k < chunk.record_count; k++) {
+			const ConversionEvent* ev = &records[k];
+			fprintf(out, "%u,%u,%u,%.2f,%.2f,%s,%s\n", ev->tick, ev->predator, ev->victim, ev->x, ev->y,
+					type_name(ev->predator_type), type_name(ev->victim_type));
+		}
+		count += chunk.record_count;
+		chunks++;
+	}
+	if (!ok) {
+		SDL_Log("\"%s\" is damaged after %d chunks, converted up to there.", log_path, chunks);
+	}
+
+	free(records);
+	fclose(in);
+	bool written = fclose(out) == 0;
+	if (!written) {
+		SDL_Log("Couldn't write \"%s\".", csv_path);
+	}
+
+	SDL_Log("Wrote %llu conversions from %d chunks to \"%s\".", (unsigned long long)count, chunks, csv_path);
+	return (ok && written) ? 0 : 1;
+}
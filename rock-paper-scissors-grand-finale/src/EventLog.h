@@ -0,0 +1,79 @@
+#pragma once
+
+#include <SDL.h>
+
+#include "AsyncFileWriter.h"
+
+// Conversion log, little-endian:
+//
+//     EventLogHeader
+//     chunks...
+//
+// Each chunk is an EventLogChunk followed by `record_count` ConversionEvents
+// and is written whole, so a log cut short by a crash loses at most the
+// chunk being filled. Entities are identified by handle slot, the same ids
+// trajectory files use.
+
+#define EVENT_LOG_MAGIC 0x56454352u        // "RCEV"
+#define EVENT_LOG_CHUNK_MAGIC 0x4B4E4843u  // "CHNK"
+#define EVENT_LOG_VERSION 1
+#define EVENT_LOG_CHUNK_RECORDS 16'384
+
+struct ConversionEvent {
+	Uint32 tick;         // the tick the conversion shows up in
+	Uint32 predator;     // handle slot
+	Uint32 victim;       // handle slot
+	float x;             // victim position
+	float y;
+	Uint8 predator_type;
+	Uint8 victim_type;   // before the conversion
+	Uint8 pad[2];
+};
+
+struct EventLogHeader {
+	Uint32 magic;
+	Uint32 version;
+	Uint32 record_size;
+	Uint32 chunk_records;
+	float map_w;
+	float map_h;
+};
+
+struct EventLogChunk {
+	Uint32 magic;
+	Uint32 record_count;
+};
+
+// Appends conversions straight into an AsyncFileWriter buffer, which is
+// handed to the writer thread a chunk at a time. Conversions only happen on
+// the simulation thread, so there's one buffer to fill.
+struct EventLog {
+	AsyncFileWriter file;
+	bool open;
+	char path[256];
+
+	EventLogChunk* chunk;     // header of the chunk being filled
+	ConversionEvent* records;
+	Uint64 event_count;
+
+	bool Open(const char* _path, float map_w, float map_h);
+
+	void Log(const ConversionEvent& ev) {
+		records[chunk->record_count++] = ev;
+		if (chunk->record_count == EVENT_LOG_CHUNK_RECORDS) {
+			Flush();
+		}
+	}
+
+	void Flush();
+	void Close();
+};
+
+struct EventsToCsvOptions {
+	const char* log_path;
+	const char* csv_path;
+};
+
+// Converts a conversion log to CSV, one row per conversion. Returns the
+// process exit code.
+int RunEventsToCsv(const EventsToCsvOptions& options);
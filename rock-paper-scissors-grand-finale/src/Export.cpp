@@ -0,0 +1,266 @@
+#include "Export.h"
+
+#include "Game.h"
+#include "AsyncFileWriter.h"
+
+#include <SDL_image.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef KERNELS_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "misc.h"
+
+#define Y4M_FRAME_TAG "FRAME\n"
+#define Y4M_FRAME_TAG_SIZE 6
+
+struct YuvJob {
+	const Uint8* pixels;  // ARGB8888
+	int pitch;
+	int w;
+	Uint8* y;
+	Uint8* u;
+	Uint8* v;
+};
+
+// BT.601 studio range in 8.8 fixed point. Chroma is the average of each
+// 2x2 block, so its coefficients take a sum of four and shift by 10.
+static Uint8 luma(Uint32 p) {
+	int r = (p >> 16) & 0xFF;
+	int g = (p >> 8) & 0xFF;
+	int b = p & 0xFF;
+	return (Uint8) (((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+static void chroma(Uint32 p0, Uint32 p1, Uint32 p2, Uint32 p3, Uint8* u, Uint8* v) {
+	int r = ((p0 >> 16) & 0xFF) + ((p1 >> 16) & 0xFF) + ((p2 >> 16) & 0xFF) + ((p3 >> 16) & 0xFF);
+	int g = ((p0 >> 8) & 0xFF) + ((p1 >> 8) & 0xFF) + ((p2 >> 8) & 0xFF) + ((p3 >> 8) & 0xFF);
+	int b = (p0 & 0xFF) + (p1 & 0xFF) + (p2 & 0xFF) + (p3 & 0xFF);
+	*u = (Uint8) (((-38 * r - 74 * g + 112 * b + 512) >> 10) + 128);
+	*v = (Uint8) (((112 * r - 94 * g - 18 * b + 512) >> 10) + 128);
+}
+
+#ifdef KERNELS_SSE2
+// [a0 + a1, a2 + a3, b0 + b1, b2 + b3]
+static __m128i add_pairs(__m128i a, __m128i b) {
+	__m128 fa = _mm_castsi128_ps(a);
+	__m128 fb = _mm_castsi128_ps(b);
+	__m128i even = _mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(2, 0, 2, 0)));
+	__m128i odd = _mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(3, 1, 3, 1)));
+	return _mm_add_epi32(even, odd);
+}
+
+// Y of 4 pixels, 32 bits each.
+static __m128i luma4(__m128i px) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i coef = _mm_setr_epi16(25, 129, 66, 0, 25, 129, 66, 0);  // B, G, R, A
+	__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(px, zero), coef);
+	__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(px, zero), coef);
+	__m128i y = _mm_add_epi32(add_pairs(lo, hi), _mm_set1_epi32(128));
+	return _mm_add_epi32(_mm_srli_epi32(y, 8), _mm_set1_epi32(16));
+}
+
+// Channel sums of the 2x2 blocks in two rows of 4 pixels, 16 bits each.
+static __m128i block_sums(__m128i a, __m128i b) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+	__m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+	return _mm_unpacklo_epi64(_mm_add_epi16(s0, _mm_srli_si128(s0, 8)),
+							  _mm_add_epi16(s1, _mm_srli_si128(s1, 8)));
+}
+
+static __m128i chroma4(__m128i q01, __m128i q23, __m128i coef) {
+	__m128i c = add_pairs(_mm_madd_epi16(q01, coef), _mm_madd_epi16(q23, coef));
+	c = _mm_srai_epi32(_mm_add_epi32(c, _mm_set1_epi32(512)), 10);
+	return _mm_add_epi32(c, _mm_set1_epi32(128));
+}
+#endif
+
+// One job is a run of row pairs: two rows of Y and one of U and V.
+static void yuv_job(void* user, int begin, int end) {
+	YuvJob* job = (YuvJob*) user;
+	int w = job->w;
+
+	for (int pair = begin; pair < end; pair++) {
+		const Uint32* row0 = (const Uint32*) (job->pixels + (size_t)(pair * 2) * job->pitch);
+		const Uint32* row1 = (const Uint32*) (job->pixels + (size_t)(pair * 2 + 1) * job->pitch);
+		Uint8* y0 = job->y + (size_t)(pair * 2) * w;
+		Uint8* y1 = y0 + w;
+		Uint8* u = job->u + (size_t)pair * (w / 2);
+		Uint8* v = job->v + (size_t)pair * (w / 2);
+
+		int x = 0;
+
+#ifdef KERNELS_SSE2
+		__m128i coef_u = _mm_setr_epi16(112, -74, -38, 0, 112, -74, -38, 0);
+		__m128i coef_v = _mm_setr_epi16(-18, -94, 112, 0, -18, -94, 112, 0);
+
+		for (; x + 8 <= w; x += 8) {
+			__m128i a0 = _mm_loadu_si128((const __m128i*) &row0[x]);
+			__m128i a1 = _mm_loadu_si128((const __m128i*) &row0[x + 4]);
+			__m128i b0 = _mm_loadu_si128((const __m128i*) &row1[x]);
+			__m128i b1 = _mm_loadu_si128((const __m128i*) &row1[x + 4]);
+
+			__m128i ya = _mm_packs_epi32(luma4(a0), luma4(a1));
+			__m128i yb = _mm_packs_epi32(luma4(b0), luma4(b1));
+			_mm_storel_epi64((__m128i*) &y0[x], _mm_packus_epi16(ya, ya));
+			_mm_storel_epi64((__m128i*) &y1[x], _mm_packus_epi16(yb, yb));
+
+			__m128i q01 = block_sums(a0, b0);
+			__m128i q23 = block_sums(a1, b1);
+			__m128i uv = _mm_packs_epi32(chroma4(q01, q23, coef_u), chroma4(q01, q23, coef_v));
+			uv = _mm_packus_epi16(uv, uv);
+			int u4 = _mm_cvtsi128_si32(uv);
+			int v4 = _mm_cvtsi128_si32(_mm_srli_si128(uv, 4));
+			memcpy(&u[x / 2], &u4, 4);
+			memcpy(&v[x / 2], &v4, 4);
+		}
+#endif
+
+		for (; x < w; x += 2) {
+			y0[x] = luma(row0[x]);
+			y0[x + 1] = luma(row0[x + 1]);
+			y1[x] = luma(row1[x]);
+			y1[x + 1] = luma(row1[x + 1]);
+			chroma(row0[x], row0[x + 1], row1[x], row1[x + 1], &u[x / 2], &v[x / 2]);
+		}
+	}
+}
+
+// Runs the simulation and writes the video. Returns false if the file
+// couldn't be written.
+static bool export_frames(Game* game, const ExportOptions& options, SDL_Renderer* renderer, SDL_Surface* surface, SDL_Texture* atlas) {
+	int w = surface->w;
+	int h = surface->h;
+	int every = SDL_max(options.every, 1);
+
+	size_t plane = (size_t)w * h;
+	size_t frame_size = Y4M_FRAME_TAG_SIZE + plane + plane / 2;
+
+	AsyncFileWriter writer;
+	if (!writer.Open(options.path, frame_size)) {
+		return false;
+	}
+
+	Uint8* header = writer.Begin();
+	int header_size = SDL_snprintf((char*) header, frame_size, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n", w, h, options.fps);
+	writer.Submit(header_size);
+
+	// The whole map, centered.
+	float zoom = SDL_min((float)w / game->map_w, (float)h / game->map_h);
+	float camera_x = (game->map_w - (float)w / zoom) * 0.5f;
+	float camera_y = (game->map_h - (float)h / zoom) * 0.5f;
+
+	double sim_time = 0.0;
+	double draw_time = 0.0;
+	double convert_time = 0.0;
+	int frames = 0;
+
+	for (int tick = 0; tick < options.ticks; tick++) {
+		double t = GetTime();
+		game->SimStep(60.0f / (float)game->sim_hz);
+		sim_time += GetTime() - t;
+
+		if (tick % every != 0) continue;
+
+		t = GetTime();
+		game->snapshot_buffer.Acquire();
+		const Snapshot* snap = &game->snapshots[game->snapshot_buffer.front];
+
+		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+		SDL_RenderClear(renderer);
+		if (options.density) {
+			game->density.Draw(renderer, &game->jobs, snap, 1.0f, camera_x, camera_y, zoom, game->density_knee);
+		} else {
+			game->sprites.Draw(renderer, &game->jobs, atlas, snap, 1.0f, camera_x, camera_y, zoom);
+		}
+		SDL_RenderFlush(renderer);
+		draw_time += GetTime() - t;
+
+		t = GetTime();
+		Uint8* frame = writer.Begin();
+		memcpy(frame, Y4M_FRAME_TAG, Y4M_FRAME_TAG_SIZE);
+
+		YuvJob job;
+		job.pixels = (const Uint8*) surface->pixels;
+		job.pitch = surface->pitch;
+		job.w = w;
+		job.y = frame + Y4M_FRAME_TAG_SIZE;
+		job.u = job.y + plane;
+		job.v = job.u + plane / 4;
+		game->jobs.ParallelFor("YUV 4:2:0", h / 2, 8, yuv_job, &job);
+
+		writer.Submit(frame_size);
+		convert_time += GetTime() - t;
+		frames++;
+	}
+
+	double wait_time = writer.wait_time;
+	Uint64 bytes = writer.bytes;
+	bool ok = writer.Close();
+	if (!ok) {
+		SDL_Log("Couldn't write \"%s\".", options.path);
+	}
+
+	SDL_Log("Wrote %d frames of %dx%d (%.1f MB) to \"%s\".", frames, w, h, (double)bytes / (1024.0 * 1024.0), options.path);
+	SDL_Log("sim %.3f ms/tick, draw %.3f ms/frame, convert %.3f ms/frame, waited %.3f ms/frame for the disk.",
+			sim_time * 1000.0 / SDL_max(options.ticks, 1),
+			draw_time * 1000.0 / SDL_max(frames, 1),
+			(convert_time - wait_time) * 1000.0 / SDL_max(frames, 1),
+			wait_time * 1000.0 / SDL_max(frames, 1));
+
+	return ok;
+}
+
+int RunExport(const ExportOptions& options) {
+	int w = options.width & ~1;
+	int h = options.height & ~1;
+	if (w < 2 || h < 2) {
+		SDL_Log("Export size %dx%d is too small.", options.width, options.height);
+		return 1;
+	}
+
+	Game* game = new Game{};
+	game->profiler.Init();
+	game->jobs.Init(&game->profiler, -1);
+	register_spatial_backends(game);
+	game->init_entity_count = options.entity_count;
+	game->Reset();
+	game->snapshot_buffer.Init();
+
+	IMG_Init(IMG_INIT_PNG);
+
+	SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, SDL_PIXELFORMAT_ARGB8888);
+	SDL_Renderer* renderer = surface ? SDL_CreateSoftwareRenderer(surface) : nullptr;
+	SDL_Texture* atlas = renderer ? IMG_LoadTexture(renderer, "entities.png") : nullptr;
+
+	bool ok = false;
+	if (!renderer) {
+		SDL_Log("Couldn't create the software renderer: %s", SDL_GetError());
+	} else if (!atlas) {
+		SDL_Log("Couldn't load \"entities.png\": %s", SDL_GetError());
+	} else {
+		ok = export_frames(game, options, renderer, surface, atlas);
+	}
+
+	if (atlas) SDL_DestroyTexture(atlas);
+	game->density.Free();
+	game->sprites.Free();
+	if (renderer) SDL_DestroyRenderer(renderer);
+	if (surface) SDL_FreeSurface(surface);
+	IMG_Quit();
+
+	for (int i = 0; i < (int)ArrayLength(game->snapshots); i++) {
+		free(game->snapshots[i].entities);
+		free(game->snapshots[i].prev);
+	}
+	game->FreeWorld();
+	game->jobs.Quit();
+	game->profiler.Quit();
+	delete game;
+
+	return ok ? 0 : 1;
+}
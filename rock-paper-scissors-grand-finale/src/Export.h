@@ -0,0 +1,19 @@
+#pragma once
+
+struct ExportOptions {
+	const char* path;
+	int entity_count = 100'000;
+	int ticks = 3'600;
+	int every = 2;        // write every Nth tick
+	int width = 1'280;    // rounded down to even
+	int height = 720;
+	int fps = 30;
+	bool density;         // density image instead of sprites
+};
+
+// Runs the simulation without a window and streams a time-lapse of the
+// whole map as a .y4m video (raw YUV 4:2:0, which ffmpeg, mpv and VLC read
+// directly). Frames are drawn by SDL's software renderer into a surface,
+// converted to YUV on the job system and written by a background thread.
+// Returns the process exit code.
+int RunExport(const ExportOptions& options);
@@ -0,0 +1,313 @@
+#include "FlowField.h"
+
+#include "Game.h"
+#include "JobSystem.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#ifdef KERNELS_SSE2
+#include <emmintrin.h>
+#endif
+
+#define FLOW_MAX_CELLS (1 << 22)
+
+// Far enough to lose every comparison, small enough that squaring it stays finite.
+#define FLOW_EMPTY 1e18f
+
+struct FlowJob {
+	FlowField* field;
+	const Entity* entities;
+	const int* type_start;
+	int step;
+};
+
+static void seed_job(void* user, int begin, int end) {
+	FlowJob* job = (FlowJob*) user;
+	FlowField* f = job->field;
+	int cells = f->w * f->h;
+
+	for (int t = begin; t < end; t++) {
+		int* site = f->site[t];
+		float* site_x = f->site_x[t];
+		float* site_y = f->site_y[t];
+
+		for (int c = 0; c < cells; c++) {
+			site[c] = -1;
+			site_x[c] = FLOW_EMPTY;
+			site_y[c] = FLOW_EMPTY;
+		}
+
+		for (int i = job->type_start[t]; i < job->type_start[t + 1]; i++) {
+			const Entity* e = &job->entities[i];
+			int cx = SDL_min(SDL_max((int) ((e->x - f->x) * f->inv_cell_size), 0), f->w - 1);
+			int cy = SDL_min(SDL_max((int) ((e->y - f->y) * f->inv_cell_size), 0), f->h - 1);
+			int c = cy * f->w + cx;
+
+			float center_x = f->x + ((float)cx + 0.5f) * f->cell_size;
+			float center_y = f->y + ((float)cy + 0.5f) * f->cell_size;
+			float dx = e->x - center_x;
+			float dy = e->y - center_y;
+			float ox = site_x[c] - center_x;
+			float oy = site_y[c] - center_y;
+			if (dx * dx + dy * dy < ox * ox + oy * oy) {
+				site[c] = i;
+				site_x[c] = e->x;
+				site_y[c] = e->y;
+			}
+		}
+	}
+}
+
+// Takes the sites of cells [x0, x1) of `src` (already offset to the
+// neighbor) where they're closer than what `dst` holds.
+static void flood_span(int x0, int x1, float base_x, float cell_size, float center_y,
+					   const int* src_site, const float* src_x, const float* src_y,
+					   int* dst_site, float* dst_x, float* dst_y, float* dst_dist) {
+	int x = x0;
+
+#ifdef KERNELS_SSE2
+	__m128 v_base = _mm_set1_ps(base_x);
+	__m128 v_cell = _mm_set1_ps(cell_size);
+	__m128 v_center_y = _mm_set1_ps(center_y);
+	__m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+
+	for (; x + 4 <= x1; x += 4) {
+		__m128 center_x = _mm_add_ps(v_base, _mm_mul_ps(_mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(x), lanes)), v_cell));
+
+		__m128 sx = _mm_loadu_ps(src_x + x);
+		__m128 sy = _mm_loadu_ps(src_y + x);
+		__m128 dx = _mm_sub_ps(sx, center_x);
+		__m128 dy = _mm_sub_ps(sy, v_center_y);
+		__m128 d = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+
+		__m128 best = _mm_loadu_ps(dst_dist + x);
+		__m128 closer = _mm_cmplt_ps(d, best);
+		__m128i mask = _mm_castps_si128(closer);
+
+		_mm_storeu_ps(dst_dist + x, _mm_min_ps(d, best));
+		_mm_storeu_ps(dst_x + x, _mm_or_ps(_mm_and_ps(closer, sx), _mm_andnot_ps(closer, _mm_loadu_ps(dst_x + x))));
+		_mm_storeu_ps(dst_y + x, _mm_or_ps(_mm_and_ps(closer, sy), _mm_andnot_ps(closer, _mm_loadu_ps(dst_y + x))));
+
+		__m128i site = _mm_loadu_si128((const __m128i*) (src_site + x));
+		__m128i old = _mm_loadu_si128((const __m128i*) (dst_site + x));
+		_mm_storeu_si128((__m128i*) (dst_site + x), _mm_or_si128(_mm_and_si128(mask, site), _mm_andnot_si128(mask, old)));
+	}
+#endif
+
+	for (; x < x1; x++) {
+		float dx = src_x[x] - (base_x + (float)x * cell_size);
+		float dy = src_y[x] - center_y;
+		float d = dx * dx + dy * dy;
+		if (d < dst_dist[x]) {
+			dst_dist[x] = d;
+			dst_site[x] = src_site[x];
+			dst_x[x] = src_x[x];
+			dst_y[x] = src_y[x];
+		}
+	}
+}
+
+// One jump flooding pass over rows [begin, end) of all three types: every
+// cell looks at its 8 neighbors `step` cells away and keeps the closest site.
+static void flood_job(void* user, int begin, int end) {
+	FlowJob* job = (FlowJob*) user;
+	FlowField* f = job->field;
+	int w = f->w;
+	int k = job->step;
+	float base_x = f->x + 0.5f * f->cell_size;
+
+	for (int r = begin; r < end; r++) {
+		int t = r / f->h;
+		int y = r % f->h;
+		int row = y * w;
+		float center_y = f->y + ((float)y + 0.5f) * f->cell_size;
+
+		int* dst_site = f->next_site[t] + row;
+		float* dst_x = f->next_x[t] + row;
+		float* dst_y = f->next_y[t] + row;
+		float* dst_dist = f->next_dist[t] + row;
+
+		for (int x = 0; x < w; x++) {
+			float sx = f->site_x[t][row + x];
+			float sy = f->site_y[t][row + x];
+			float dx = sx - (base_x + (float)x * f->cell_size);
+			float dy = sy - center_y;
+			dst_site[x] = f->site[t][row + x];
+			dst_x[x] = sx;
+			dst_y[x] = sy;
+			dst_dist[x] = dx * dx + dy * dy;
+		}
+
+		for (int oy = -1; oy <= 1; oy++) {
+			int ny = y + oy * k;
+			if (ny < 0 || ny >= f->h) continue;
+
+			for (int ox = -1; ox <= 1; ox++) {
+				if (ox == 0 && oy == 0) continue;
+
+				int shift = ox * k;
+				int x0 = SDL_max(0, -shift);
+				int x1 = SDL_min(w, w - shift);
+				if (x0 >= x1) continue;
+
+				int src = ny * w + shift;
+				flood_span(x0, x1, base_x, f->cell_size, center_y,
+						   f->site[t] + src, f->site_x[t] + src, f->site_y[t] + src,
+						   dst_site, dst_x, dst_y, dst_dist);
+			}
+		}
+	}
+}
+
+void FlowField::Build(const Entity* entities, const int* type_start, float _cell_size, const SDL_FRect* bounds, JobSystem* jobs) {
+	int count = type_start[3];
+
+	float min_x = 0.0f;
+	float min_y = 0.0f;
+	float max_x = 0.0f;
+	float max_y = 0.0f;
+	if (bounds) {
+		min_x = bounds->x;
+		min_y = bounds->y;
+		max_x = bounds->x + bounds->w;
+		max_y = bounds->y + bounds->h;
+	} else if (count > 0) {
+		min_x = max_x = entities[0].x;
+		min_y = max_y = entities[0].y;
+		for (int i = 1; i < count; i++) {
+			min_x = fminf(min_x, entities[i].x);
+			min_y = fminf(min_y, entities[i].y);
+			max_x = fmaxf(max_x, entities[i].x);
+			max_y = fmaxf(max_y, entities[i].y);
+		}
+	}
+
+	cell_size = (_cell_size > 1.0f) ? _cell_size : 1.0f;
+	for (;;) {
+		w = (int) ((max_x - min_x) / cell_size) + 1;
+		h = (int) ((max_y - min_y) / cell_size) + 1;
+		if ((Sint64)w * (Sint64)h <= FLOW_MAX_CELLS) break;
+		cell_size *= 1.5f;
+	}
+
+	x = min_x;
+	y = min_y;
+	inv_cell_size = 1.0f / cell_size;
+
+	int cells = w * h;
+	if (cells > cell_capacity) {
+		Free();
+		cell_capacity = cells;
+		for (int t = 0; t < 3; t++) {
+			site[t] = (int*) malloc(cells * sizeof(int));
+			site_x[t] = (float*) malloc(cells * sizeof(float));
+			site_y[t] = (float*) malloc(cells * sizeof(float));
+			next_site[t] = (int*) malloc(cells * sizeof(int));
+			next_x[t] = (float*) malloc(cells * sizeof(float));
+			next_y[t] = (float*) malloc(cells * sizeof(float));
+			next_dist[t] = (float*) malloc(cells * sizeof(float));
+
+			if (!site[t] || !site_x[t] || !site_y[t] || !next_site[t] || !next_x[t] || !next_y[t] || !next_dist[t]) {
+				SDL_Log("Out of memory.");
+				exit(1);
+			}
+		}
+	}
+
+	FlowJob job;
+	job.field = this;
+	job.entities = entities;
+	job.type_start = type_start;
+	job.step = 0;
+
+	jobs->ParallelFor("Flow Field Seed", 3, 1, seed_job, &job);
+
+	// Steps of n/2, n/4 ... 1, then one more 1 to fix most of the misses.
+	int steps[32];
+	int step_count = 0;
+	int step = 1;
+	while (step * 2 < SDL_max(w, h)) {
+		step *= 2;
+	}
+	for (; step > 0; step /= 2) {
+		steps[step_count++] = step;
+	}
+	steps[step_count++] = 1;
+
+	for (int i = 0; i < step_count; i++) {
+		job.step = steps[i];
+		jobs->ParallelFor("Flow Field Flood", 3 * h, 8, flood_job, &job);
+
+		for (int t = 0; t < 3; t++) {
+			int* s = site[t];
+			site[t] = next_site[t];
+			next_site[t] = s;
+
+			float* sx = site_x[t];
+			site_x[t] = next_x[t];
+			next_x[t] = sx;
+
+			float* sy = site_y[t];
+			site_y[t] = next_y[t];
+			next_y[t] = sy;
+		}
+	}
+}
+
+void FlowField::Free() {
+	for (int t = 0; t < 3; t++) {
+		free(site[t]);
+		free(site_x[t]);
+		free(site_y[t]);
+		free(next_site[t]);
+		free(next_x[t]);
+		free(next_y[t]);
+		free(next_dist[t]);
+		site[t] = nullptr;
+		site_x[t] = nullptr;
+		site_y[t] = nullptr;
+		next_site[t] = nullptr;
+		next_x[t] = nullptr;
+		next_y[t] = nullptr;
+		next_dist[t] = nullptr;
+	}
+	cell_capacity = 0;
+}
+
+ClosestResult FlowField::FindClosest(const Entity* entities, float px, float py, EntityType type, float radius) const {
+	int cx = SDL_min(SDL_max((int) ((px - x) * inv_cell_size), 0), w - 1);
+	int cy = SDL_min(SDL_max((int) ((py - y) * inv_cell_size), 0), h - 1);
+
+	int index = -1;
+	float best = radius * radius;
+
+	// The sites of the surrounding cells too: the cell's own site is only
+	// nearest to its center.
+	for (int t = 0; t < 3; t++) {
+		if (t == (int)type) continue;
+
+		for (int yy = SDL_max(cy - 1, 0); yy <= SDL_min(cy + 1, h - 1); yy++) {
+			for (int xx = SDL_max(cx - 1, 0); xx <= SDL_min(cx + 1, w - 1); xx++) {
+				int s = site[t][yy * w + xx];
+				if (s < 0) continue;
+
+				float dx = entities[s].x - px;
+				float dy = entities[s].y - py;
+				float d = dx * dx + dy * dy;
+				if (d < best) {
+					best = d;
+					index = s;
+				}
+			}
+		}
+	}
+
+	// Nothing is known about the runner-up, so the result can't be cached.
+	ClosestResult result;
+	result.index = index;
+	result.dist = (index >= 0) ? sqrtf(best) : radius;
+	result.second_dist = result.dist;
+	result.complete = true;
+	return result;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <SDL.h>
+
+#include "SpatialGrid.h"
+
+struct Entity;
+enum struct EntityType;
+struct JobSystem;
+
+// Nearest entity of every type for each cell of a coarse grid, flooded out
+// from the cells the entities sit in with jump flooding. Lookups are O(1)
+// but approximate: they pick the closest of the sites of the surrounding
+// cells, and jump flooding can occasionally miss one.
+struct FlowField {
+	float x;
+	float y;
+	float cell_size;
+	float inv_cell_size;
+	int w;
+	int h;
+	int cell_capacity;
+
+	// Per type, struct-of-arrays so the flood passes compare four cells at a
+	// time. Passes read `site*` and write `next*`, then swap.
+	int* site[3];       // entity index, -1 = none
+	float* site_x[3];
+	float* site_y[3];
+	int* next_site[3];
+	float* next_x[3];
+	float* next_y[3];
+	float* next_dist[3];
+
+	// Covers `bounds` if given, otherwise the entities' bounding box.
+	void Build(const Entity* entities, const int* type_start, float _cell_size, const SDL_FRect* bounds, JobSystem* jobs);
+	void Free();
+
+	ClosestResult FindClosest(const Entity* entities, float px, float py, EntityType type, float radius) const;
+};
@@ -10,18 +10,52 @@
 
 #include "misc.h"
 #include "mathh.h"
+#include "Morton.h"
 
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_sdl2.h"
 #include "imgui/imgui_impl_sdlrenderer2.h"
 
+const char* boundary_mode_names[(int)BoundaryMode::COUNT] = {
+	"None",
+	"Clamp",
+	"Reflect",
+	"Torus",
+};
+
 void Game::Reset() {
 	if (entities) free(entities);
-
-	entity_count = init_entity_count;
+	if (targets) free(targets);
+	if (conversions) free(conversions);
+	if (conversion_entities) free(conversion_entities);
+	if (retarget_queue) free(retarget_queue);
+	if (reorder_keys) free(reorder_keys);
+	if (reorder_indices) free(reorder_indices);
+	if (entities_scratch) free(entities_scratch);
+	if (targets_scratch) free(targets_scratch);
+	if (handles) free(handles);
+	if (handle_table) free(handle_table);
+	if (handles_scratch) free(handles_scratch);
+	if (prev_positions) free(prev_positions);
+
+	entity_count = SDL_min(init_entity_count, ENTITY_MAX_COUNT);
 	entities = (Entity*) malloc(entity_count * sizeof(Entity));
-
-	if (!entities) {
+	targets = (EntityTarget*) malloc(entity_count * sizeof(EntityTarget));
+	conversions = (Conversion*) malloc(entity_count * sizeof(Conversion));
+	conversion_entities = (Entity*) malloc(entity_count * sizeof(Entity));
+	retarget_queue = (int*) malloc(entity_count * sizeof(int));
+	reorder_keys = (Uint32*) malloc(2 * entity_count * sizeof(Uint32));
+	reorder_indices = (int*) malloc(2 * entity_count * sizeof(int));
+	entities_scratch = (Entity*) malloc(entity_count * sizeof(Entity));
+	targets_scratch = (EntityTarget*) malloc(entity_count * sizeof(EntityTarget));
+	handles = (EntityHandle*) malloc(entity_count * sizeof(EntityHandle));
+	handle_table = (Uint32*) malloc(entity_count * sizeof(Uint32));
+	handles_scratch = (EntityHandle*) malloc(entity_count * sizeof(EntityHandle));
+	prev_positions = (float*) malloc(2 * entity_count * sizeof(float));
+
+	if (!entities || !targets || !conversions || !conversion_entities || !retarget_queue
+		|| !reorder_keys || !reorder_indices || !entities_scratch || !targets_scratch
+		|| !handles || !handle_table || !handles_scratch || !prev_positions) {
 		SDL_Log("Out of memory.");
 		exit(1);
 	}
@@ -34,11 +68,191 @@ void Game::Reset() {
 		e->y = random.range(0.0f, map_h);
 		e->type = (EntityType) (random.next() % 3);
 	}
+
+	for (int i = 0; i < entity_count; i++) {
+		targets[i].handle = 0;
+		targets[i].dist = INFINITY;
+		targets[i].bound = -INFINITY;
+	}
+
+	// A new generation makes handles from the previous world stale.
+	handle_generation = (handle_generation + 1) & 0xFF;
+	if (handle_generation == 0) handle_generation = 1;
+
+	for (int i = 0; i < entity_count; i++) {
+		handles[i] = (handle_generation << ENTITY_HANDLE_SLOT_BITS) | (Uint32)i;
+		handle_table[i] = (handle_generation << ENTITY_HANDLE_SLOT_BITS) | (Uint32)i;
+	}
+
+	// Nothing to interpolate from in a new world.
+	for (int i = 0; i < entity_count; i++) {
+		prev_positions[i * 2 + 0] = entities[i].x;
+		prev_positions[i * 2 + 1] = entities[i].y;
+	}
+
+	conversion_count = 0;
+	conversion_overflow = false;
+	retarget_cursor = 0;
+	targets_reset = true;
+	reorder_ticks = 0;
+
+	// Sets up the type ranges.
+	ReorderEntities();
+}
+
+void Game::FreeWorld() {
+	free(entities);
+	free(targets);
+	free(conversions);
+	free(conversion_entities);
+	free(retarget_queue);
+	free(reorder_keys);
+	free(reorder_indices);
+	free(entities_scratch);
+	free(targets_scratch);
+	free(handles);
+	free(handle_table);
+	free(handles_scratch);
+	free(prev_positions);
+	entities = nullptr;
+	targets = nullptr;
+	conversions = nullptr;
+	conversion_entities = nullptr;
+	retarget_queue = nullptr;
+	reorder_keys = nullptr;
+	reorder_indices = nullptr;
+	entities_scratch = nullptr;
+	targets_scratch = nullptr;
+	handles = nullptr;
+	handle_table = nullptr;
+	handles_scratch = nullptr;
+	prev_positions = nullptr;
+
+	free(packed);
+	packed = nullptr;
+	packed_capacity = 0;
+
+	tiles.Free();
+	grid.Free();
+	conversion_grid.Free();
+	quadtree.Free();
+	flow_field.Free();
+	for (int i = 0; i < (int)ArrayLength(kd_trees); i++) {
+		kd_trees[i].Free();
+	}
+}
+
+void Game::CaptureTrace(int frames) {
+	char path[256];
+	if (trace_path) {
+		SDL_snprintf(path, sizeof(path), "%s", trace_path);
+	} else {
+		SDL_snprintf(path, sizeof(path), "trace_frame%d.json", frame);
+	}
+
+	profiler.BeginCapture(frames, path);
+}
+
+void Game::ResetFrameStats() {
+	double budget = 1.0 / (double)GAME_FPS;
+
+	frame_hist.Clear();
+	frame_hist.budget = budget;
+	update_hist.Clear();
+	update_hist.budget = budget;
+	draw_hist.Clear();
+	draw_hist.budget = budget;
+}
+
+void Game::DumpFrameStats() {
+	Histogram* histograms[] = {&frame_hist, &update_hist, &draw_hist};
+	const char* names[] = {"frame", "update", "draw"};
+
+	for (int i = 0; i < (int)ArrayLength(histograms); i++) {
+		Histogram* h = histograms[i];
+		SDL_Log("%-6s p50 %.2fms  p90 %.2fms  p99 %.2fms  max %.2fms  over budget %u/%u",
+				names[i],
+				h->Percentile(0.50) * 1000.0,
+				h->Percentile(0.90) * 1000.0,
+				h->Percentile(0.99) * 1000.0,
+				h->max * 1000.0,
+				h->over_budget,
+				h->count);
+	}
+
+	const char* path = "frame_histogram.csv";
+	FILE* f = fopen(path, "wb");
+	if (!f) {
+		SDL_Log("Couldn't open \"%s\" for writing.", path);
+		return;
+	}
+	write_histograms_csv(f, histograms, names, ArrayLength(histograms));
+	fclose(f);
+
+	SDL_Log("Wrote \"%s\".", path);
+}
+
+static void histogram_row(const char* name, Histogram* h) {
+	ImGui::TableNextRow();
+	ImGui::TableNextColumn(); ImGui::TextUnformatted(name);
+	ImGui::TableNextColumn(); ImGui::Text("%.2f", h->Percentile(0.50) * 1000.0);
+	ImGui::TableNextColumn(); ImGui::Text("%.2f", h->Percentile(0.90) * 1000.0);
+	ImGui::TableNextColumn(); ImGui::Text("%.2f", h->Percentile(0.99) * 1000.0);
+	ImGui::TableNextColumn(); ImGui::Text("%.2f", h->max * 1000.0);
+	ImGui::TableNextColumn(); ImGui::Text("%u", h->over_budget);
+}
+
+static int sim_thread_main(void* data) {
+	Game* game = (Game*) data;
+	game->profiler.RegisterThread("Simulation");
+
+	double next = GetTime();
+	while (!game->sim_quit) {
+		// Same speed in real time at any tick rate.
+		if (game->viewing) {
+			game->PlaybackStep();
+		} else {
+			game->SimStep(60.0f / (float)game->sim_hz);
+		}
+
+		// Fixed rate. After a long tick, carry on from now instead of catching up.
+		next += 1.0 / (double)game->sim_hz;
+		double left = next - GetTime();
+		if (left > 0.0) {
+			SDL_Delay((Uint32) (left * 1000.0));
+		} else {
+			next = GetTime();
+		}
+	}
+
+	return 0;
+}
+
+static int audio_thread_main(void* data) {
+	Game* game = (Game*) data;
+
+	while (!game->audio_quit) {
+		SDL_SemWaitTimeout(game->audio_wake, 100);
+		game->PlayQueuedSounds();
+	}
+
+	return 0;
 }
 
 void Game::Init() {
 	SDL_LogSetAllPriority(SDL_LOG_PRIORITY_VERBOSE);
 
+	profiler.Init();
+
+	// The simulation and render threads work on their own pool's loops too,
+	// so workers plus those two add up to one thread per core.
+	int cpus = SDL_GetCPUCount();
+	int render_workers = SDL_max(cpus / 4 - 1, 0);
+	jobs.Init(&profiler, SDL_max(cpus - 2 - render_workers, 0));
+	render_jobs.Init(&profiler, render_workers);
+	register_spatial_backends(this);
+	ResetFrameStats();
+
 	SDL_Init(SDL_INIT_VIDEO
 			 | SDL_INIT_AUDIO);
 	IMG_Init(IMG_INIT_PNG);
@@ -89,20 +303,103 @@ void Game::Init() {
 	ImGui_ImplSDL2_InitForSDLRenderer(window, renderer);
 	ImGui_ImplSDLRenderer2_Init(renderer);
 
+	if (view_path) {
+		viewing = playback.Open(view_path);
+		if (viewing) {
+			map_w = playback.header.map_w;
+			map_h = playback.header.map_h;
+			playback_shown = -1;
+		}
+	}
+
 	Reset();
+
+	snapshot_buffer.Init();
+	sim_messages.Init(sizeof(SimMessage), SIM_MESSAGE_CAPACITY);
+	update_times.Init(sizeof(double), UPDATE_TIME_CAPACITY);
+	ui_settings = GetSettings();
+	if (viewing) {
+		PlaybackStep();
+	} else {
+		PublishSnapshot(0.0);
+	}
+
+	audio_events.Init(sizeof(AudioEvent), AUDIO_EVENT_CAPACITY);
+
+#ifndef __EMSCRIPTEN__
+	audio_wake = SDL_CreateSemaphore(0);
+	if (audio_wake) {
+		audio_thread = SDL_CreateThread(audio_thread_main, "Audio", this);
+	}
+	if (!audio_thread) {
+		SDL_Log("Couldn't start the audio thread, playing sounds inline: %s", SDL_GetError());
+	}
+
+	sim_thread = SDL_CreateThread(sim_thread_main, "Simulation", this);
+	if (!sim_thread) {
+		SDL_Log("Couldn't start the simulation thread, running it inline: %s", SDL_GetError());
+	}
+#endif
+
+	if (trace_on_start_frames > 0) {
+		CaptureTrace(trace_on_start_frames);
+	}
+
+	if (record_on_start) {
+		SendToSim(SimMessageType::RECORD_START, 0.0f, 0.0f);
+	}
+	if (event_log_on_start) {
+		SendToSim(SimMessageType::EVENT_LOG_START, 0.0f, 0.0f);
+	}
 }
 
 void Game::Quit() {
+	if (sim_thread) {
+		sim_quit = true;
+		SDL_WaitThread(sim_thread, nullptr);
+		sim_thread = nullptr;
+	}
+	trajectory.Close();
+	event_log.Close();
+	playback.Close();
+
+	if (audio_thread) {
+		audio_quit = true;
+		SDL_SemPost(audio_wake);
+		SDL_WaitThread(audio_thread, nullptr);
+		audio_thread = nullptr;
+	}
+	if (audio_wake) {
+		SDL_DestroySemaphore(audio_wake);
+		audio_wake = nullptr;
+	}
+	audio_events.Free();
+
+	DumpFrameStats();
+	jobs.Quit();
+	render_jobs.Quit();
+	profiler.Quit();
+
 	ImGui_ImplSDLRenderer2_Shutdown();
 	ImGui_ImplSDL2_Shutdown();
 	ImGui::DestroyContext();
 
-	free(entities);
+	FreeWorld();
+
+	for (int i = 0; i < (int)ArrayLength(snapshots); i++) {
+		free(snapshots[i].entities);
+		free(snapshots[i].prev);
+		snapshots[i] = {};
+	}
+	sim_messages.Free();
+	update_times.Free();
 
 	Mix_FreeChunk(snd_scissors);
 	Mix_FreeChunk(snd_paper);
 	Mix_FreeChunk(snd_rock);
 
+	density.Free();
+	sprites.Free();
 	SDL_DestroyTexture(tex_entities);
 
 	SDL_DestroyRenderer(renderer);
@@ -121,11 +418,15 @@ void Game::Run() {
 }
 
 void Game::Frame() {
+	Uint64 frame_begin = SDL_GetPerformanceCounter();
+
 	double t = GetTime();
 
-	double frame_end_time = t + (1.0 / (double)GAME_FPS);
+	double frame_end_time = t + (1.0 / (double)render_fps);
 
 	{
+		PROFILE_ZONE(&profiler, "Events");
+
 		SDL_Event ev;
 		while (SDL_PollEvent(&ev)) {
 			ImGui_ImplSDL2_ProcessEvent(&ev);
@@ -140,12 +441,13 @@ void Game::Frame() {
 					SDL_Scancode scancode = ev.key.keysym.scancode;
 					switch (scancode) {
 						case SDL_SCANCODE_P: {
-							paused ^= true;
+							ui_settings.paused ^= true;
+							ui_settings_dirty = true;
 							break;
 						}
 
 						case SDL_SCANCODE_R: {
-							Reset();
+							SendToSim(SimMessageType::RESET, 0.0f, 0.0f);
 							break;
 						}
 
@@ -153,19 +455,95 @@ void Game::Frame() {
 							main_window_open ^= true;
 							break;
 						}
+
+						case SDL_SCANCODE_F3: {
+							profiler_window_open ^= true;
+							break;
+						}
+
+						case SDL_SCANCODE_F9: {
+							CaptureTrace(trace_frames);
+							break;
+						}
+					}
+					break;
+				}
+
+				case SDL_MOUSEBUTTONDOWN: {
+					if (ev.button.button == SDL_BUTTON_RIGHT && !ImGui::GetIO().WantCaptureMouse) {
+						SendToSim(SimMessageType::SELECT,
+								  (float)ev.button.x / camera_zoom + camera_x,
+								  (float)ev.button.y / camera_zoom + camera_y);
+					}
+					break;
+				}
+
+				case SDL_MOUSEWHEEL: {
+					if (!ImGui::GetIO().WantCaptureMouse) {
+						// Keep the world point under the cursor in place.
+						int mx;
+						int my;
+						SDL_GetMouseState(&mx, &my);
+						float zoom = SDL_clamp(camera_zoom * powf(1.25f, (float)ev.wheel.y), 0.02f, 8.0f);
+						camera_x += (float)mx / camera_zoom - (float)mx / zoom;
+						camera_y += (float)my / camera_zoom - (float)my / zoom;
+						camera_zoom = zoom;
 					}
+					break;
 				}
 			}
 		}
 	}
 
-	float delta = 60.0f / (float)GAME_FPS;
+	float delta = 60.0f / (float)render_fps;
 
-	double update_took = GetTime();
-	if (!paused) {
-		Update(delta);
+	// Without a simulation thread, run as many ticks as the time since the
+	// last frame covers.
+	if (!sim_thread) {
+		if (prev_time > 0.0) {
+			sim_accumulator += SDL_min(t - prev_time, 0.25);
+		}
+		double interval = 1.0 / (double)sim_hz;
+		while (sim_accumulator >= interval) {
+			if (viewing) {
+				PlaybackStep();
+			} else {
+				SimStep(60.0f / (float)sim_hz);
+			}
+			sim_accumulator -= interval;
+		}
+	}
+
+	if (!audio_thread) {
+		PlayQueuedSounds();
+	}
+
+	snapshot_buffer.Acquire();
+	const Snapshot* snap = &snapshots[snapshot_buffer.front];
+
+	// How far we are between the snapshot's tick and the next one.
+	double alpha = 1.0;
+	if (interpolate) {
+		if (sim_thread) {
+			alpha = (GetTime() - snap->time) / snap->interval;
+		} else {
+			alpha = sim_accumulator * (double)sim_hz;
+		}
+		alpha = SDL_clamp(alpha, 0.0, 1.0);
+	}
+	// Every tick since the last frame, not just the one on screen.
+	double update_took;
+	while (update_times.Pop(&update_took)) {
+		update_hist.Add(update_took);
+	}
+
+	if (snap->tick != drawn_tick) {
+		if (ui_settings.auto_tune) {
+			ui_settings.spatial_mode = snap->spatial_mode;
+			ui_settings.grid_cell_size = snap->grid_cell_size;
+		}
+		drawn_tick = snap->tick;
 	}
-	update_took = GetTime() - update_took;
 
 	const Uint8* key = SDL_GetKeyboardState(nullptr);
 
@@ -177,18 +555,20 @@ void Game::Frame() {
 		float spd = 20.0f;
 		if (key[SDL_SCANCODE_LSHIFT]) spd = 10.0f;
 
-		if (key[SDL_SCANCODE_LEFT])  camera_x -= spd * delta;
-		if (key[SDL_SCANCODE_RIGHT]) camera_x += spd * delta;
-		if (key[SDL_SCANCODE_UP])    camera_y -= spd * delta;
-		if (key[SDL_SCANCODE_DOWN])  camera_y += spd * delta;
+		if (key[SDL_SCANCODE_LEFT])  camera_x -= spd * delta / camera_zoom;
+		if (key[SDL_SCANCODE_RIGHT]) camera_x += spd * delta / camera_zoom;
+		if (key[SDL_SCANCODE_UP])    camera_y -= spd * delta / camera_zoom;
+		if (key[SDL_SCANCODE_DOWN])  camera_y += spd * delta / camera_zoom;
 
 		if (mouse & SDL_BUTTON(SDL_BUTTON_LEFT)) {
-			camera_x -= (float) mouse_dx;
-			camera_y -= (float) mouse_dy;
+			camera_x -= (float) mouse_dx / camera_zoom;
+			camera_y -= (float) mouse_dy / camera_zoom;
 		}
 	}
 
 	{
+		PROFILE_ZONE(&profiler, "UI");
+
 		ImGui_ImplSDLRenderer2_NewFrame();
 		ImGui_ImplSDL2_NewFrame();
 		ImGui::NewFrame();
@@ -196,27 +576,227 @@ void Game::Frame() {
 		main_window_focused = false;
 		if (main_window_open) {
 			if (ImGui::Begin("Rock Paper Scissors Grand Finale", &main_window_open)) {
-				ImGui::DragInt("Entity Count", &init_entity_count, 1.0f, 1, 5'000, "%d", ImGuiSliderFlags_AlwaysClamp);
-				ImGui::DragFloat("Map Width", &map_w);
-				ImGui::DragFloat("Map Height", &map_h);
-				ImGui::DragFloat("Entity Speed", &entity_speed, 0.1f);
-				ImGui::DragFloat("Entity Run Away Speed", &entity_run_away_speed, 0.1f);
-				ImGui::DragFloat("Entity Shiver Amount", &entity_shiver_multiplier, 0.1f);
+				ui_settings_dirty |= ImGui::DragInt("Entity Count", &ui_settings.init_entity_count, 1.0f, 1, 5'000, "%d", ImGuiSliderFlags_AlwaysClamp);
+				ui_settings_dirty |= ImGui::DragFloat("Map Width", &ui_settings.map_w);
+				ui_settings_dirty |= ImGui::DragFloat("Map Height", &ui_settings.map_h);
+				ui_settings_dirty |= ImGui::DragFloat("Entity Speed", &ui_settings.entity_speed, 0.1f);
+				ui_settings_dirty |= ImGui::DragFloat("Entity Run Away Speed", &ui_settings.entity_run_away_speed, 0.1f);
+				ui_settings_dirty |= ImGui::DragFloat("Entity Shiver Amount", &ui_settings.entity_shiver_multiplier, 0.1f);
+				ui_settings_dirty |= ImGui::DragFloat("Perception Radius", &ui_settings.perception_radius, 1.0f, 0.0f, 100'000.0f, "%.0f", ImGuiSliderFlags_AlwaysClamp);
+				ImGui::SetItemTooltip("0 sees the whole map.");
+				{
+					int mode = (int)ui_settings.boundary_mode;
+					if (ImGui::Combo("World Edges", &mode, boundary_mode_names, (int)BoundaryMode::COUNT)) {
+						ui_settings.boundary_mode = (BoundaryMode)mode;
+						ui_settings_dirty = true;
+					}
+				}
+				{
+					int mode = (int)ui_settings.spatial_mode;
+					auto backend_name = [](void* user, int i) {
+						return (const char*) ((Game*)user)->backends[i].name;
+					};
+					if (ImGui::Combo("Spatial Index", &mode, backend_name, this, (int)SpatialMode::COUNT)) {
+						ui_settings.spatial_mode = (SpatialMode)mode;
+						ui_settings_dirty = true;
+					}
+				}
+				if (ui_settings.spatial_mode == SpatialMode::BRUTE_FORCE) {
+					ui_settings_dirty |= ImGui::Checkbox("Compact Entities", &ui_settings.compact_entities);
+					ui_settings_dirty |= ImGui::Checkbox("Tiled", &ui_settings.tiled_brute_force);
+					ImGui::SetItemTooltip("Finds targets and collision pairs in one cache-blocked pass.");
+				}
+				if (ui_settings.spatial_mode == SpatialMode::FLOW_FIELD) {
+					ui_settings_dirty |= ImGui::DragFloat("Flow Cell Size", &ui_settings.flow_cell_size, 1.0f, 4.0f, 256.0f, "%.0f", ImGuiSliderFlags_AlwaysClamp);
+				}
+				if (ui_settings.spatial_mode == SpatialMode::BARNES_HUT) {
+					ui_settings_dirty |= ImGui::SliderFloat("Opening Angle", &ui_settings.barnes_hut_theta, 0.0f, 2.0f, "%.2f");
+					ImGui::SetItemTooltip("0 is exact, higher is faster and rougher.");
+				}
+				if (backends[(int)ui_settings.spatial_mode].approximate) {
+					ui_settings_dirty |= ImGui::DragInt("Drift Samples", &ui_settings.drift_samples, 1.0f, 0, 4'096, "%d", ImGuiSliderFlags_AlwaysClamp);
+				}
+				if (ui_settings.spatial_mode == SpatialMode::GRID) {
+					ui_settings_dirty |= ImGui::DragFloat("Grid Cell Size", &ui_settings.grid_cell_size, 1.0f, 8.0f, 1'024.0f, "%.0f", ImGuiSliderFlags_AlwaysClamp);
+				}
+				ui_settings_dirty |= ImGui::Checkbox("Auto Tune", &ui_settings.auto_tune);
+				if (ui_settings.auto_tune) {
+					ui_settings_dirty |= ImGui::DragFloat("Tune Interval (s)", &ui_settings.auto_tune_interval, 0.1f, 0.5f, 60.0f, "%.1f", ImGuiSliderFlags_AlwaysClamp);
+					for (int m = 0; m < (int)SpatialMode::COUNT; m++) {
+						if (!backends[m].tunable) continue;
+
+						const char* mark = (m == (int)snap->spatial_mode) ? ">" : " ";
+						if (m == (int)SpatialMode::GRID) {
+							ImGui::Text("%s %s (%.0f): %.3f ms", mark, backends[m].name, snap->grid_cell_size, snap->auto_tune_ms[m]);
+						} else {
+							ImGui::Text("%s %s: %.3f ms", mark, backends[m].name, snap->auto_tune_ms[m]);
+						}
+					}
+				}
+				ui_settings_dirty |= ImGui::Checkbox("Target Cache", &ui_settings.target_cache);
+				if (ui_settings.target_cache) {
+					ui_settings_dirty |= ImGui::DragInt("Retarget Budget", &ui_settings.retarget_budget, 10.0f, 0, 1'000'000, ui_settings.retarget_budget ? "%d" : "No Limit", ImGuiSliderFlags_AlwaysClamp);
+				}
+				ui_settings_dirty |= ImGui::DragInt("Simulation Rate (Hz)", &ui_settings.sim_hz, 1.0f, 10, 240, "%d", ImGuiSliderFlags_AlwaysClamp);
+				ImGui::DragInt("Render FPS", &render_fps, 1.0f, 10, 360, "%d", ImGuiSliderFlags_AlwaysClamp);
+				ImGui::Checkbox("Interpolate", &interpolate);
+				ImGui::SetItemTooltip("Draws in between the last two ticks, one tick behind.");
+				ImGui::DragFloat("Zoom", &camera_zoom, 0.01f, 0.02f, 8.0f, "%.2f", ImGuiSliderFlags_AlwaysClamp | ImGuiSliderFlags_Logarithmic);
+				ImGui::Checkbox("Density View", &density_view);
+				ImGui::SetItemTooltip("One pixel per entity, brighter where they pile up. For large counts or far zoom.");
+				if (density_view) {
+					ImGui::DragFloat("Density Knee", &density_knee, 0.05f, 0.1f, 1'000.0f, "%.2f", ImGuiSliderFlags_AlwaysClamp | ImGuiSliderFlags_Logarithmic);
+					ImGui::SetItemTooltip("Entities per pixel drawn at half brightness.");
+				}
+				ui_settings_dirty |= ImGui::DragInt("Reorder Interval", &ui_settings.reorder_interval, 1.0f, 0, 600, "%d", ImGuiSliderFlags_AlwaysClamp);
 				if (ImGui::Button("Pause (P)")) {
-					paused ^= true;
+					ui_settings.paused ^= true;
+					ui_settings_dirty = true;
 				}
 				if (ImGui::Button("Reset (R)")) {
-					Reset();
+					SendToSim(SimMessageType::RESET, 0.0f, 0.0f);
+				}
+				ImGui::Checkbox("Show Profiler (F3)", &profiler_window_open);
+				ImGui::DragInt("Trace Frames", &trace_frames, 1.0f, 1, 3'600, "%d", ImGuiSliderFlags_AlwaysClamp);
+				if (ImGui::Button("Capture Trace (F9)")) {
+					CaptureTrace(trace_frames);
+				}
+				if (profiler.capturing || profiler.capture_frames_left > 0) {
+					ImGui::SameLine();
+					ImGui::Text("Capturing... %d frames left", profiler.capture_frames_left);
+				} else if (profiler.flushing) {
+					ImGui::SameLine();
+					ImGui::Text("Writing trace...");
+				}
+				if (ImGui::CollapsingHeader("Selected Entity", ImGuiTreeNodeFlags_DefaultOpen)) {
+					int i = snap->selected_index;
+					if (i >= 0) {
+						const char* type_names[] = {"Rock", "Paper", "Scissors"};
+						const Entity* e = &snap->entities[i];
+						ImGui::Text("Handle %08x (index %d)", snap->selected, i);
+						ImGui::Text("%s at %.1f, %.1f", type_names[(int)e->type], e->x, e->y);
+
+						int target = snap->selected_target;
+						if (target >= 0) {
+							ImGui::Text("Target %08x, %s, %.1f away", snap->selected_target_handle,
+										type_names[(int)snap->entities[target].type], snap->selected_target_dist);
+						} else {
+							ImGui::Text("No target");
+						}
+						if (ImGui::Button("Deselect")) {
+							SendToSim(SimMessageType::DESELECT, 0.0f, 0.0f);
+						}
+					} else {
+						ImGui::Text("Right click an entity to select it.");
+					}
+				}
+				if (ImGui::CollapsingHeader("Recording")) {
+					ImGui::BeginDisabled(snap->recording);
+					ImGui::InputText("File", record_path, sizeof(record_path));
+					ImGui::EndDisabled();
+					if (snap->recording) {
+						if (ImGui::Button("Stop Recording")) {
+							SendToSim(SimMessageType::RECORD_STOP, 0.0f, 0.0f);
+						}
+						double mb = (double)snap->record_bytes / (1024.0 * 1024.0);
+						ImGui::Text("%d frames, %.2f MB", snap->record_frames, mb);
+						ImGui::Text("%.1fx smaller than raw snapshots", snap->record_bytes > 0 ? (double)snap->record_raw_bytes / (double)snap->record_bytes : 0.0);
+						ImGui::Text("%.2f MB/s", snap->record_seconds > 0.0 ? mb / snap->record_seconds : 0.0);
+					} else if (ImGui::Button("Start Recording")) {
+						SendToSim(SimMessageType::RECORD_START, 0.0f, 0.0f);
+					}
+				}
+				if (ImGui::CollapsingHeader("Conversion Log")) {
+					ImGui::BeginDisabled(snap->event_logging);
+					ImGui::InputText("Log File", event_log_path, sizeof(event_log_path));
+					ImGui::EndDisabled();
+					if (snap->event_logging) {
+						if (ImGui::Button("Stop Logging")) {
+							SendToSim(SimMessageType::EVENT_LOG_STOP, 0.0f, 0.0f);
+						}
+						ImGui::Text("%llu conversions", (unsigned long long)snap->event_count);
+					} else if (ImGui::Button("Start Logging")) {
+						SendToSim(SimMessageType::EVENT_LOG_START, 0.0f, 0.0f);
+					}
+				}
+				if (ImGui::CollapsingHeader("Frame Times")) {
+					if (ImGui::BeginTable("frame_times", 6, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+						ImGui::TableSetupColumn("ms");
+						ImGui::TableSetupColumn("p50");
+						ImGui::TableSetupColumn("p90");
+						ImGui::TableSetupColumn("p99");
+						ImGui::TableSetupColumn("max");
+						ImGui::TableSetupColumn("over budget");
+						ImGui::TableHeadersRow();
+						histogram_row("Frame", &frame_hist);
+						histogram_row("Update", &update_hist);
+						histogram_row("Draw", &draw_hist);
+						ImGui::EndTable();
+					}
+					ImGui::Text("%u frames", frame_hist.count);
+					if (ImGui::Button("Reset Stats")) {
+						ResetFrameStats();
+					}
+					ImGui::SameLine();
+					if (ImGui::Button("Dump Histogram")) {
+						DumpFrameStats();
+					}
 				}
 				ImGui::Text("Press ESC to toggle this window.");
 				main_window_focused = ImGui::IsWindowFocused();
 			}
 			ImGui::End();
 		}
+
+		if (viewing) {
+			if (ImGui::Begin("Playback")) {
+				if (ImGui::Button(ui_settings.paused ? "Play (P)" : "Pause (P)")) {
+					ui_settings.paused ^= true;
+					ui_settings_dirty = true;
+				}
+				ImGui::SameLine();
+				if (ImGui::ArrowButton("step_back", ImGuiDir_Left)) {
+					playback_seek = snap->playback_frame - 1;
+					SendToSim(SimMessageType::SEEK, 0.0f, 0.0f);
+				}
+				ImGui::SameLine();
+				if (ImGui::ArrowButton("step_forward", ImGuiDir_Right)) {
+					playback_seek = snap->playback_frame + 1;
+					SendToSim(SimMessageType::SEEK, 0.0f, 0.0f);
+				}
+
+				// Follows playback unless it's being dragged.
+				if (!playback_scrubbing) {
+					playback_scrub = snap->playback_frame;
+				}
+				if (ImGui::SliderInt("Frame", &playback_scrub, 0, snap->playback_frame_count - 1)) {
+					playback_seek = playback_scrub;
+					SendToSim(SimMessageType::SEEK, 0.0f, 0.0f);
+				}
+				playback_scrubbing = ImGui::IsItemActive();
+
+				ImGui::Text("Frame %d of %d, tick %llu", snap->playback_frame + 1, snap->playback_frame_count, (unsigned long long)snap->tick);
+				ui_settings_dirty |= ImGui::DragInt("Playback Rate (Hz)", &ui_settings.sim_hz, 1.0f, 10, 240, "%d", ImGuiSliderFlags_AlwaysClamp);
+				main_window_focused |= ImGui::IsWindowFocused();
+			}
+			ImGui::End();
+		}
+
+		if (profiler_window_open) {
+			profiler.DrawOverlay(&profiler_window_open);
+			main_window_focused |= ImGui::IsWindowFocused(ImGuiFocusedFlags_AnyWindow);
+		}
+
+		if (ui_settings_dirty) {
+			SendToSim(SimMessageType::SETTINGS, 0.0f, 0.0f);
+		}
 	}
 
 	double draw_took = GetTime();
-	Draw(delta);
+	{
+		PROFILE_ZONE(&profiler, "Draw");
+		Draw(snap, (float)alpha);
+	}
 	draw_took = GetTime() - draw_took;
 
 #ifndef __EMSCRIPTEN__
@@ -228,141 +808,1316 @@ void Game::Frame() {
 	}
 #endif
 
+	if (prev_time > 0.0) {
+		frame_hist.Add(t - prev_time);
+	}
+	draw_hist.Add(draw_took);
+
 	if (frame % 60 == 0) {
 		double fps = 1.0 / (t - prev_time);
-		SDL_Log("update: %fms", update_took * 1000.0);
+		SDL_Log("update: %fms", snap->update_took * 1000.0);
 		SDL_Log("draw:   %fms", draw_took * 1000.0);
-		SDL_Log("FPS:    %.2f\n\n", fps);
+		SDL_Log("FPS:    %.2f", fps);
+		SDL_Log("frame:  p99 %.2fms  max %.2fms  over budget %u/%u\n\n",
+				frame_hist.Percentile(0.99) * 1000.0,
+				frame_hist.max * 1000.0,
+				frame_hist.over_budget,
+				frame_hist.count);
 	}
 
 	frame++;
 
 	prev_time = t;
+
+	profiler.Record("Frame", frame_begin, SDL_GetPerformanceCounter(), nullptr);
+	profiler.FrameEnd();
 }
 
 Entity* Game::find_closest(Entity* e) {
-	Entity* result = nullptr;
-	float dist = INFINITY;
+	ClosestResult r = query_closest(e, search_radius());
+	return (r.index >= 0) ? &entities[r.index] : nullptr;
+}
 
-	for (int i = 0; i < entity_count; i++) {
-		Entity* e2 = &entities[i];
+ClosestResult Game::query_point(EntityType type, float px, float py, float radius, int max_rings) {
+	return backend()->closest(this, type, px, py, radius, max_rings);
+}
 
-		if (e->type == e2->type) {
-			continue;
+static ClosestResult merge_closest(const ClosestResult& a, const ClosestResult& b) {
+	ClosestResult result;
+	if (b.index >= 0 && b.dist < a.dist) {
+		result.index = b.index;
+		result.dist = b.dist;
+		result.second_dist = fminf(fminf(a.dist, a.second_dist), b.second_dist);
+	} else {
+		result.index = a.index;
+		result.dist = a.dist;
+		result.second_dist = fminf(a.second_dist, fminf(b.dist, b.second_dist));
+	}
+	result.complete = a.complete && b.complete;
+	return result;
+}
+
+// On a torus, enemies across an edge are found by also querying the images
+// of the point on the other side, as long as the edge is within reach.
+ClosestResult Game::query_closest_wrapped(const Entity* e, float radius, int max_rings) {
+	ClosestResult r = query_point(e->type, e->x, e->y, radius, max_rings);
+	if (boundary_mode != BoundaryMode::TORUS) {
+		return r;
+	}
+
+	// No enemies left anywhere.
+	if (r.index < 0 && r.complete && radius == INFINITY) {
+		return r;
+	}
+
+	for (int iy = -1; iy <= 1; iy++) {
+		for (int ix = -1; ix <= 1; ix++) {
+			if (ix == 0 && iy == 0) continue;
+
+			// The image at x + map_w sees entities near the right edge from the left one.
+			float reach = r.second_dist;
+			if (ix > 0 && e->x >= reach) continue;
+			if (ix < 0 && map_w - e->x >= reach) continue;
+			if (iy > 0 && e->y >= reach) continue;
+			if (iy < 0 && map_h - e->y >= reach) continue;
+
+			ClosestResult image = query_point(e->type, e->x + (float)ix * map_w, e->y + (float)iy * map_h, reach, max_rings);
+			r = merge_closest(r, image);
 		}
+	}
+
+	return r;
+}
 
-		float d = point_distance(e->x, e->y, e2->x, e2->y);
-		if (d < dist) {
-			dist = d;
-			result = e2;
+ClosestResult Game::query_closest(const Entity* e, float radius) {
+	return query_closest_wrapped(e, radius, -1);
+}
+
+// Cheap search around `e` for revalidating a cached target. Returns false
+// if it couldn't be settled without a full query.
+bool Game::query_closest_local(const Entity* e, float radius, ClosestResult* result) {
+	switch (backend()->local) {
+		case LocalQuery::RINGS: {
+			*result = query_closest_wrapped(e, radius, target_local_rings);
+			return result->complete && (result->index >= 0 || radius == perception_radius);
+		}
+
+		case LocalQuery::RADIUS: {
+			if (radius == INFINITY) {
+				return false;
+			}
+			*result = query_closest(e, radius);
+			return result->index >= 0 || radius == perception_radius;
+		}
+
+		case LocalQuery::NONE: {
+			return false;
 		}
 	}
 
-	return result;
+	return false;
 }
 
-void Game::Update(float delta) {
+// Broadphase candidates around a point. On a torus the images across the
+// edges within `radius` are asked too.
+void Game::query_overlaps(float px, float py, float radius, OverlapFn fn, void* user) {
+	const SpatialBackend* b = backend();
+	b->overlaps(this, px, py, radius, fn, user);
+	if (boundary_mode != BoundaryMode::TORUS) {
+		return;
+	}
+
+	for (int iy = -1; iy <= 1; iy++) {
+		for (int ix = -1; ix <= 1; ix++) {
+			if (ix == 0 && iy == 0) continue;
+
+			if (ix > 0 && px >= radius) continue;
+			if (ix < 0 && map_w - px >= radius) continue;
+			if (iy > 0 && py >= radius) continue;
+			if (iy < 0 && map_h - py >= radius) continue;
+
+			b->overlaps(this, px + (float)ix * map_w, py + (float)iy * map_h, radius, fn, user);
+		}
+	}
+}
+
+// Same as query_overlaps, over this tick's conversions.
+void Game::for_each_conversion_near(float px, float py, float radius, OverlapFn fn, void* user) {
+	conversion_grid.ForEachNear(px, py, radius, fn, user);
+	if (boundary_mode != BoundaryMode::TORUS) {
+		return;
+	}
+
+	for (int iy = -1; iy <= 1; iy++) {
+		for (int ix = -1; ix <= 1; ix++) {
+			if (ix == 0 && iy == 0) continue;
+
+			if (ix > 0 && px >= radius) continue;
+			if (ix < 0 && map_w - px >= radius) continue;
+			if (iy > 0 && py >= radius) continue;
+			if (iy < 0 && map_h - py >= radius) continue;
+
+			conversion_grid.ForEachNear(px + (float)ix * map_w, py + (float)iy * map_h, radius, fn, user);
+		}
+	}
+}
+
+void Game::BuildSpatialIndex() {
+	backend()->build(this);
+}
+
+void Game::RegisterBackend(SpatialMode mode, const SpatialBackend& backend) {
+	backends[(int)mode] = backend;
+}
+
+void Game::record_conversion(int predator, int victim, EntityType from) {
+	if (event_log.open) {
+		ConversionEvent ev = {};
+		ev.tick = (Uint32) (tick + 1);
+		ev.predator = handles[predator] & ENTITY_HANDLE_SLOT_MASK;
+		ev.victim = handles[victim] & ENTITY_HANDLE_SLOT_MASK;
+		ev.x = entities[victim].x;
+		ev.y = entities[victim].y;
+		ev.predator_type = (Uint8)entities[predator].type;
+		ev.victim_type = (Uint8)from;
+		event_log.Log(ev);
+	}
+
+	if (conversion_count >= entity_count) {
+		conversion_overflow = true;
+		return;
+	}
+
+	Conversion* c = &conversions[conversion_count++];
+	c->handle = handles[victim];
+	c->from = from;
+}
+
+static void retarget_job(void* user, int begin, int end) {
+	Game* game = (Game*) user;
+
+	for (int i = begin; i < end; i++) {
+		ClosestResult r = game->query_closest(&game->entities[i], game->search_radius());
+		EntityTarget* t = &game->targets[i];
+		t->handle = (r.index >= 0) ? game->handles[r.index] : 0;
+		t->dist = r.dist;
+		t->bound = -INFINITY;
+	}
+}
+
+// Compares approximate targets of a few entities with an exact search.
+void Game::MeasureTargetDrift() {
+	int samples = SDL_min(drift_samples, entity_count);
+	if (samples <= 0) return;
+
+	int exact = 0;
+	double drift = 0.0;
+	for (int s = 0; s < samples; s++) {
+		int i = (int) (((Sint64)s * entity_count / samples + drift_cursor) % entity_count);
+		Entity* e = &entities[i];
+
+		float best = search_radius();
+		int best_index = -1;
+		for (int t = 0; t < 3; t++) {
+			if (t == (int)e->type) continue;
+
+			for (int j = type_start[t]; j < type_start[t + 1]; j++) {
+				float d = distance(e->x, e->y, entities[j].x, entities[j].y);
+				if (d < best) {
+					best = d;
+					best_index = j;
+				}
+			}
+		}
+
+		int target = resolve(targets[i].handle);
+		if (target == best_index) {
+			exact++;
+		} else if (target >= 0) {
+			drift += distance(e->x, e->y, entities[target].x, entities[target].y) - best;
+		}
+	}
+	drift_cursor++;
+
+	profiler.CountRatio("Targets Exact", (double)exact, (double)samples);
+	profiler.Count("Target Drift (px)", drift / (double)samples);
+}
+
+struct ConversionScan {
+	Game* game;
+	int i;
+	int target;
+	float d;
+	float bound;
+};
+
+// Entities that just left our type are new enemies the bound doesn't cover.
+static void conversion_scan(void* user, int k) {
+	ConversionScan* s = (ConversionScan*) user;
+	Game* game = s->game;
+	Entity* e = &game->entities[s->i];
+	Conversion* c = &game->conversions[k];
+	if (c->from != e->type || c->handle == game->handles[s->i] || c->handle == game->handles[s->target]) return;
+
+	int j = game->resolve(c->handle);
+	Entity* x = &game->entities[j];
+	if (x->type == e->type) return;
+
+	float dx = game->distance(e->x, e->y, x->x, x->y);
+	if (dx < s->d) {
+		s->bound = fminf(s->bound, s->d);
+		s->target = j;
+		s->d = dx;
+	} else {
+		s->bound = fminf(s->bound, dx);
+	}
+}
+
+void Game::UpdateTargets(float delta) {
+	// Collisions are checked after both entities of a pair have moved.
+	if (spatial_mode == SpatialMode::BRUTE_FORCE && tiled_brute_force) {
+		tiles.Run(this, 32.0f + 2.0f * max_step(delta));
+		conversion_count = 0;
+		conversion_overflow = false;
+		return;
+	}
+
+	if (!target_cache || approximate_targets()) {
+		jobs.ParallelFor("Retarget", entity_count, 1'024, retarget_job, this);
+		if (approximate_targets()) {
+			MeasureTargetDrift();
+		}
+		conversion_count = 0;
+		conversion_overflow = false;
+		return;
+	}
+
+	float decay = 2.0f * max_step(delta);
+
+	// Conversions that didn't fit in the list could be enemies no bound
+	// accounts for.
+	if (conversion_overflow) {
+		for (int i = 0; i < entity_count; i++) {
+			targets[i].bound = -INFINITY;
+		}
+	}
+
+	// An entity that converted now has different enemies.
+	for (int k = 0; k < conversion_count; k++) {
+		targets[resolve(conversions[k].handle)].handle = 0;
+	}
+
+	// A conversion only matters to entities whose bound reaches it, so
+	// they're put in a grid of their own, about one per cell, and each
+	// entity only looks at the ones nearby.
+	bool scan = !conversion_overflow && conversion_count > 0;
+	float scan_reach = 0.0f;
+	if (scan) {
+		for (int k = 0; k < conversion_count; k++) {
+			conversion_entities[k] = entities[resolve(conversions[k].handle)];
+		}
+		float cell = sqrtf(map_w * map_h / (float)conversion_count);
+		conversion_grid.Build(conversion_entities, conversion_count, fmaxf(cell, 32.0f), nullptr);
+		scan_reach = 4.0f * conversion_grid.cell_size;
+	}
+
+	int hits = 0;
+	int local = 0;
+	int full = 0;
+	int deferred = 0;
+
+	// Entities whose cached target couldn't be confirmed, waiting for a full query.
+	int* stale = retarget_queue;
+	int stale_count = 0;
+
 	for (int i = 0; i < entity_count; i++) {
 		Entity* e = &entities[i];
+		EntityTarget* t = &targets[i];
+
+		t->bound -= decay;
 
-		EntityType prey = EntityType::SCISSORS;
-		// EntityType predator = EntityType::PAPER;
-		if (e->type == EntityType::PAPER) {
-			prey = EntityType::ROCK;
-			// predator = EntityType::SCISSORS;
-		} else if (e->type == EntityType::SCISSORS) {
-			prey = EntityType::PAPER;
-			// predator = EntityType::ROCK;
+		int target = resolve(t->handle);
+		if (target >= 0 && entities[target].type == e->type) {
+			target = -1;
 		}
 
-		if (Entity* e2 = find_closest(e)) {
-			float dx = e2->x - e->x;
-			float dy = e2->y - e->y;
-			normalize0(dx, dy, &dx, &dy);
+		float d = INFINITY;
+		if (target >= 0) {
+			Entity* e2 = &entities[target];
+			d = distance(e->x, e->y, e2->x, e2->y);
+			if (d > search_radius()) {
+				target = -1;
+				d = INFINITY;
+			}
+		}
+		if (target >= 0) {
+			// Past the bound nothing can change the outcome. A far-reaching
+			// bound is cut down to keep the scan short, but not below the
+			// target, which would turn a hit into a miss.
+			if (scan && d <= t->bound) {
+				ConversionScan s = {this, i, target, d, fminf(t->bound, fmaxf(d, scan_reach))};
+				for_each_conversion_near(e->x, e->y, s.bound, conversion_scan, &s);
+				target = s.target;
+				d = s.d;
+				t->bound = s.bound;
+			}
+
+			t->handle = handles[target];
+			t->dist = d;
 
-			float spd = entity_speed;
-			if (e2->type != prey) {
-				spd = entity_run_away_speed;
-				dx = -dx;
-				dy = -dy;
+			if (d <= t->bound) {
+				hits++;
+				continue;
 			}
+		}
 
-			e->x += dx * spd * delta;
-			e->y += dy * spd * delta;
+		// Nothing can be closer than the old target, so a search bounded by
+		// its distance (and for the grid, a few rings of cells) usually
+		// settles it. Reaching a little further leaves a bound that holds
+		// for the next few ticks. Without a target, the perception radius
+		// bounds it.
+		{
+			float reach = d * 1.0001f + 0.001f + TARGET_CACHE_SLACK * decay;
+			float radius = (target >= 0) ? fminf(reach, search_radius()) : search_radius();
+			ClosestResult r;
+			if (query_closest_local(e, radius, &r)) {
+				t->handle = (r.index >= 0) ? handles[r.index] : 0;
+				t->dist = r.dist;
+				t->bound = r.second_dist;
+				local++;
+				continue;
+			}
+		}
 
-			if (entity_shiver_multiplier > 0.0f) {
-				float shiver = spd * entity_shiver_multiplier;
-				e->x += random.range(-shiver, shiver);
-				e->y += random.range(-shiver, shiver);
+		if (target < 0) {
+			t->handle = 0;
+		}
+		stale[stale_count++] = i;
+	}
+
+	// Full queries for the rest, round-robin from where we stopped last tick
+	// so nobody starves when the budget runs out.
+	int budget = (targets_reset || retarget_budget == 0) ? stale_count : retarget_budget;
+	int start = 0;
+	while (start < stale_count && stale[start] < retarget_cursor) {
+		start++;
+	}
+	if (start == stale_count) {
+		start = 0;
+	}
+
+	retarget_cursor = 0;
+	for (int n = 0; n < stale_count; n++) {
+		int i = stale[(start + n) % stale_count];
+		EntityTarget* t = &targets[i];
+
+		if (full >= budget) {
+			if (deferred == 0) {
+				retarget_cursor = i;
 			}
+
+			// Keep chasing the old target if it's still an enemy. Entities
+			// that had none stand still until their turn comes.
+			t->bound = -INFINITY;
+			deferred++;
+			continue;
 		}
+
+		ClosestResult r = query_closest(&entities[i], search_radius());
+		t->handle = (r.index >= 0) ? handles[r.index] : 0;
+		t->dist = r.dist;
+		t->bound = r.second_dist;
+		full++;
+	}
+
+	conversion_count = 0;
+	conversion_overflow = false;
+	targets_reset = false;
+
+	profiler.CountRatio("Target Cache Hit Rate", (double)hits, (double)entity_count);
+	profiler.Count("Retargets (local)", (double)local);
+	profiler.Count("Retargets (full)", (double)full);
+	profiler.Count("Retargets (deferred)", (double)deferred);
+}
+
+void Game::ReorderEntities() {
+	if (entity_count == 0) {
+		type_start[0] = type_start[1] = type_start[2] = type_start[3] = 0;
+		return;
 	}
 
+	float min_x = INFINITY;
+	float min_y = INFINITY;
+	float max_x = -INFINITY;
+	float max_y = -INFINITY;
 	for (int i = 0; i < entity_count; i++) {
-		Entity* e = &entities[i];
+		min_x = fminf(min_x, entities[i].x);
+		min_y = fminf(min_y, entities[i].y);
+		max_x = fmaxf(max_x, entities[i].x);
+		max_y = fmaxf(max_y, entities[i].y);
+	}
 
-		for (int j = 0; j < entity_count; j++) {
-			if (i == j) {
-				continue;
+	float scale_x = (max_x > min_x) ? 32767.0f / (max_x - min_x) : 0.0f;
+	float scale_y = (max_y > min_y) ? 32767.0f / (max_y - min_y) : 0.0f;
+
+	// Type in the top two bits, a 15-bit per axis Morton code below it.
+	Uint32* keys = reorder_keys;
+	int* order = reorder_indices;
+	int counts[3] = {};
+	for (int i = 0; i < entity_count; i++) {
+		Uint32 x = (Uint32) fminf((entities[i].x - min_x) * scale_x, 32767.0f);
+		Uint32 y = (Uint32) fminf((entities[i].y - min_y) * scale_y, 32767.0f);
+		keys[i] = ((Uint32)entities[i].type << 30) | morton_encode(x, y);
+		order[i] = i;
+		counts[(int)entities[i].type]++;
+	}
+
+	type_start[0] = 0;
+	type_start[1] = counts[0];
+	type_start[2] = counts[0] + counts[1];
+	type_start[3] = entity_count;
+
+	radix_sort(keys, order, reorder_keys + entity_count, reorder_indices + entity_count, entity_count);
+
+	// Targets and conversions hold handles, only the table needs fixing.
+	for (int k = 0; k < entity_count; k++) {
+		entities_scratch[k] = entities[order[k]];
+		targets_scratch[k] = targets[order[k]];
+
+		EntityHandle h = handles[order[k]];
+		handles_scratch[k] = h;
+		handle_table[h & ENTITY_HANDLE_SLOT_MASK] = (h & ~ENTITY_HANDLE_SLOT_MASK) | (Uint32)k;
+	}
+
+	Entity* old_entities = entities;
+	entities = entities_scratch;
+	entities_scratch = old_entities;
+
+	EntityTarget* old_targets = targets;
+	targets = targets_scratch;
+	targets_scratch = old_targets;
+
+	EntityHandle* old_handles = handles;
+	handles = handles_scratch;
+	handles_scratch = old_handles;
+
+	retarget_cursor = 0;
+}
+
+void Game::apply_boundary(Entity* e) {
+	switch (boundary_mode) {
+		case BoundaryMode::CLAMP: {
+			e->x = clamp(e->x, 0.0f, map_w);
+			e->y = clamp(e->y, 0.0f, map_h);
+			break;
+		}
+
+		case BoundaryMode::REFLECT: {
+			if (e->x < 0.0f) e->x = -e->x;
+			if (e->x > map_w) e->x = 2.0f * map_w - e->x;
+			if (e->y < 0.0f) e->y = -e->y;
+			if (e->y > map_h) e->y = 2.0f * map_h - e->y;
+
+			// Still out after a step longer than the map (or a resize).
+			e->x = clamp(e->x, 0.0f, map_w);
+			e->y = clamp(e->y, 0.0f, map_h);
+			break;
+		}
+
+		case BoundaryMode::TORUS: {
+			e->x -= map_w * floorf(e->x / map_w);
+			e->y -= map_h * floorf(e->y / map_h);
+			if (e->x >= map_w) e->x = 0.0f;
+			if (e->y >= map_h) e->y = 0.0f;
+			break;
+		}
+
+		case BoundaryMode::NONE: {
+			break;
+		}
+
+		default: {
+			break;
+		}
+	}
+}
+
+void Game::select_entity_at(float x, float y) {
+	int index = -1;
+	float best = 20.0f * 20.0f;
+	for (int i = 0; i < entity_count; i++) {
+		float dx = entities[i].x - x;
+		float dy = entities[i].y - y;
+		float d = dx * dx + dy * dy;
+		if (d < best) {
+			best = d;
+			index = i;
+		}
+	}
+
+	selected = (index >= 0) ? handles[index] : 0;
+}
+
+SimSettings Game::GetSettings() const {
+	SimSettings s;
+	s.init_entity_count = init_entity_count;
+	s.map_w = map_w;
+	s.map_h = map_h;
+	s.entity_speed = entity_speed;
+	s.entity_run_away_speed = entity_run_away_speed;
+	s.entity_shiver_multiplier = entity_shiver_multiplier;
+	s.perception_radius = perception_radius;
+	s.boundary_mode = boundary_mode;
+	s.spatial_mode = spatial_mode;
+	s.grid_cell_size = grid_cell_size;
+	s.compact_entities = compact_entities;
+	s.tiled_brute_force = tiled_brute_force;
+	s.flow_cell_size = flow_cell_size;
+	s.barnes_hut_theta = barnes_hut_theta;
+	s.drift_samples = drift_samples;
+	s.auto_tune = auto_tune;
+	s.auto_tune_interval = auto_tune_interval;
+	s.target_cache = target_cache;
+	s.retarget_budget = retarget_budget;
+	s.reorder_interval = reorder_interval;
+	s.sim_hz = sim_hz;
+	s.paused = paused;
+	return s;
+}
+
+void Game::ApplySettings(const SimSettings& s) {
+	init_entity_count = s.init_entity_count;
+	map_w = s.map_w;
+	map_h = s.map_h;
+	entity_speed = s.entity_speed;
+	entity_run_away_speed = s.entity_run_away_speed;
+	entity_shiver_multiplier = s.entity_shiver_multiplier;
+	perception_radius = s.perception_radius;
+	boundary_mode = s.boundary_mode;
+	compact_entities = s.compact_entities;
+	tiled_brute_force = s.tiled_brute_force;
+	flow_cell_size = s.flow_cell_size;
+	barnes_hut_theta = s.barnes_hut_theta;
+	drift_samples = s.drift_samples;
+	auto_tune = s.auto_tune;
+	auto_tune_interval = s.auto_tune_interval;
+	target_cache = s.target_cache;
+	retarget_budget = s.retarget_budget;
+	reorder_interval = s.reorder_interval;
+	sim_hz = s.sim_hz;
+	paused = s.paused;
+
+	// The tuner owns these while it's on.
+	if (!auto_tune) {
+		spatial_mode = s.spatial_mode;
+		grid_cell_size = s.grid_cell_size;
+	}
+}
+
+// Pending settings go first, so e.g. a reset sees the new entity count.
+void Game::SendToSim(SimMessageType type, float x, float y) {
+	SimMessage m = {};
+	if (ui_settings_dirty) {
+		m.type = SimMessageType::SETTINGS;
+		m.settings = ui_settings;
+		if (sim_messages.Push(&m)) {
+			ui_settings_dirty = false;
+		}
+	}
+	if (type == SimMessageType::SETTINGS) {
+		return;
+	}
+
+	m.type = type;
+	m.x = x;
+	m.y = y;
+	if (type == SimMessageType::RECORD_START) {
+		SDL_strlcpy(m.path, record_path, sizeof(m.path));
+	}
+	if (type == SimMessageType::EVENT_LOG_START) {
+		SDL_strlcpy(m.path, event_log_path, sizeof(m.path));
+	}
+	if (type == SimMessageType::SEEK) {
+		m.frame = playback_seek;
+	}
+	if (!sim_messages.Push(&m)) {
+		SDL_Log("Simulation message queue is full, dropping a message.");
+	}
+}
+
+// Runs on the simulation thread, or inline from Frame without one.
+void Game::SimStep(float delta) {
+	SimMessage m;
+	while (sim_messages.Pop(&m)) {
+		switch (m.type) {
+			case SimMessageType::SETTINGS: {
+				ApplySettings(m.settings);
+				break;
+			}
+
+			case SimMessageType::RESET: {
+				Reset();
+				trajectory.need_keyframe = true;
+				break;
 			}
 
-			Entity* e2 = &entities[j];
+			case SimMessageType::SELECT: {
+				select_entity_at(m.x, m.y);
+				break;
+			}
 
-			if (!circle_vs_circle(e->x, e->y, 16.0f, e2->x, e2->y, 16.0f)) {
-				continue;
+			case SimMessageType::DESELECT: {
+				selected = 0;
+				break;
+			}
+
+			case SimMessageType::RECORD_START: {
+				trajectory.Close();
+				trajectory.Open(m.path, map_w, map_h);
+				break;
+			}
+
+			case SimMessageType::RECORD_STOP: {
+				trajectory.Close();
+				break;
+			}
+
+			case SimMessageType::EVENT_LOG_START: {
+				event_log.Close();
+				event_log.Open(m.path, map_w, map_h);
+				break;
+			}
+
+			case SimMessageType::EVENT_LOG_STOP: {
+				event_log.Close();
+				break;
+			}
+
+			case SimMessageType::SEEK: {
+				// Only sent while viewing, PlaybackStep handles it.
+				break;
+			}
+		}
+	}
+
+	// Paused, previous and current positions are the same and nothing moves.
+	for (int i = 0; i < entity_count; i++) {
+		Uint32 slot = handles[i] & ENTITY_HANDLE_SLOT_MASK;
+		prev_positions[slot * 2 + 0] = entities[i].x;
+		prev_positions[slot * 2 + 1] = entities[i].y;
+	}
+
+	double update_took = 0.0;
+	if (!paused) {
+		PROFILE_ZONE(&profiler, "Update");
+		update_took = GetTime();
+		Update(delta);
+		update_took = GetTime() - update_took;
+
+		// The render thread drains it every frame, so it's only full
+		// while frames stall for seconds; those ticks go unsampled.
+		update_times.Push(&update_took);
+
+		if (trajectory.open) {
+			PROFILE_ZONE(&profiler, "Record");
+			trajectory.WriteFrame(tick + 1, entities, handles, entity_count);
+		}
+	}
+
+	tick++;
+	PublishSnapshot(update_took);
+
+	// One wake-up per tick, however many sounds it queued.
+	if (audio_wake) {
+		SDL_SemPost(audio_wake);
+	}
+	profiler.Count("Sounds Dropped", (double)audio_events_dropped);
+	audio_events_dropped = 0;
+}
+
+void Game::PlayQueuedSounds() {
+	// Drain everything first so a burst of conversions plays each sound once.
+	bool pending[3] = {};
+	AudioEvent ev;
+	while (audio_events.Pop(&ev)) {
+		pending[(int)ev.type] = true;
+	}
+
+	Mix_Chunk* chunks[3] = {snd_rock, snd_paper, snd_scissors};
+	double now = GetTime();
+	for (int i = 0; i < 3; i++) {
+		if (pending[i] && now - sound_last_played[i] >= SOUND_MIN_INTERVAL) {
+			play_sound(chunks[i]);
+			sound_last_played[i] = now;
+		}
+	}
+}
+
+static void snapshot_reserve(Snapshot* s, int count) {
+	if (count > s->entity_capacity) {
+		free(s->entities);
+		free(s->prev);
+		s->entity_capacity = count;
+		s->entities = (Entity*) malloc(s->entity_capacity * sizeof(Entity));
+		s->prev = (float*) malloc(2 * s->entity_capacity * sizeof(float));
+		if (!s->entities || !s->prev) {
+			SDL_Log("Out of memory.");
+			exit(1);
+		}
+	}
+}
+
+void Game::PublishSnapshot(double update_took) {
+	Snapshot* s = &snapshots[snapshot_buffer.back];
+
+	snapshot_reserve(s, entity_count);
+	memcpy(s->entities, entities, entity_count * sizeof(Entity));
+	s->entity_count = entity_count;
+	s->tick = tick;
+	s->update_took = update_took;
+	s->time = GetTime();
+	s->interval = 1.0 / (double)sim_hz;
+
+	// Entities move between indices during a tick, their handle slots don't.
+	for (int i = 0; i < entity_count; i++) {
+		Uint32 slot = handles[i] & ENTITY_HANDLE_SLOT_MASK;
+		float dx;
+		float dy;
+		offset(entities[i].x, entities[i].y, prev_positions[slot * 2 + 0], prev_positions[slot * 2 + 1], &dx, &dy);
+		s->prev[i * 2 + 0] = entities[i].x + dx;
+		s->prev[i * 2 + 1] = entities[i].y + dy;
+	}
+
+	s->spatial_mode = spatial_mode;
+	s->grid_cell_size = grid_cell_size;
+	memcpy(s->auto_tune_ms, auto_tune_ms, sizeof(auto_tune_ms));
+
+	s->selected = selected;
+	s->selected_index = resolve(selected);
+	s->selected_target = -1;
+	s->selected_target_handle = 0;
+	s->selected_target_dist = 0.0f;
+	if (s->selected_index >= 0) {
+		EntityTarget* t = &targets[s->selected_index];
+		s->selected_target = resolve(t->handle);
+		s->selected_target_handle = t->handle;
+		s->selected_target_dist = t->dist;
+	}
+
+	s->recording = trajectory.open;
+	s->record_frames = trajectory.frame_count;
+	s->record_bytes = trajectory.offset;
+	s->record_raw_bytes = trajectory.raw_bytes;
+	s->record_seconds = trajectory.open ? GetTime() - trajectory.start_time : 0.0;
+
+	s->event_logging = event_log.open;
+	s->event_count = event_log.open ? event_log.event_count + event_log.chunk->record_count : 0;
+
+	s->playback_frame = 0;
+	s->playback_frame_count = 0;
+
+	snapshot_buffer.Publish();
+}
+
+static bool playback_decode(TrajectoryReader* r, int f) {
+	if (r->Decode(f)) return true;
+
+	SDL_Log("The trajectory is damaged at frame %d, playing up to there.", f);
+	r->frame_count = f;
+	return false;
+}
+
+// Runs instead of SimStep in viewer mode.
+void Game::PlaybackStep() {
+	SimMessage m;
+	int seek = -1;
+	while (sim_messages.Pop(&m)) {
+		switch (m.type) {
+			case SimMessageType::SETTINGS: {
+				sim_hz = m.settings.sim_hz;
+				paused = m.settings.paused;
+				break;
+			}
+
+			case SimMessageType::SEEK: {
+				seek = m.frame;
+				break;
+			}
+
+			default: {
+				// Nothing to simulate.
+				break;
+			}
+		}
+	}
+
+	if (playback.frame_count == 0) return;
+
+	if (seek >= 0) {
+		playback_target = seek;
+	} else if (!paused && playback_target == playback_shown) {
+		playback_target++;
+	}
+	playback_target = SDL_clamp(playback_target, 0, playback.frame_count - 1);
+
+	if (playback_target != playback_shown) {
+		PROFILE_ZONE(&profiler, "Decode");
+		double decode_start = GetTime();
+
+		// Decode toward the target for at most a tick, so a long seek shows
+		// its keyframe right away and catches up over the next few ticks,
+		// and the timeline never waits on it.
+		int target = playback_target;
+		int key = playback.KeyframeBefore(target);
+		bool ok = true;
+		if (playback.frame < 0 || playback.frame > target || playback.frame < key) {
+			ok = playback_decode(&playback, key);
+		}
+		double budget_end = decode_start + 1.0 / (double)sim_hz;
+		while (ok && playback.frame < target && GetTime() < budget_end) {
+			ok = playback_decode(&playback, playback.frame + 1);
+		}
+
+		if (playback.frame >= 0 && playback.frame != playback_shown) {
+			PublishPlayback();
+			playback_shown = playback.frame;
+		}
+	}
+
+	// Decode ahead while this frame is on screen, so the next one is ready
+	// when it's due. This thread has nothing else to do between ticks in
+	// viewer mode, so it decodes here rather than on a job worker.
+	if (!paused && playback.frame == playback_shown && playback.frame + 1 < playback.frame_count) {
+		PROFILE_ZONE(&profiler, "Decode Ahead");
+		playback_decode(&playback, playback.frame + 1);
+	}
+}
+
+void Game::PublishPlayback() {
+	Snapshot* s = &snapshots[snapshot_buffer.back];
+	const TrajectoryReader* r = &playback;
+
+	snapshot_reserve(s, r->entity_count);
+
+	float scale = 1.0f / r->header.quant;
+	float half_w = r->header.map_w * 0.5f;
+	float half_h = r->header.map_h * 0.5f;
+	for (int i = 0; i < r->entity_count; i++) {
+		float x = (float)r->q[i * 2 + 0] * scale;
+		float y = (float)r->q[i * 2 + 1] * scale;
+		float px = (float)r->prev_q[i * 2 + 0] * scale;
+		float py = (float)r->prev_q[i * 2 + 1] * scale;
+
+		// Wrapping around a torus isn't a walk across the map.
+		if (fabsf(x - px) > half_w) px = x;
+		if (fabsf(y - py) > half_h) py = y;
+
+		s->entities[i].type = (EntityType)r->type[i];
+		s->entities[i].x = x;
+		s->entities[i].y = y;
+		s->prev[i * 2 + 0] = px;
+		s->prev[i * 2 + 1] = py;
+	}
+	s->entity_count = r->entity_count;
+	s->tick = r->index[r->frame].tick;
+	s->update_took = 0.0;  // nothing was simulated, decoding shows up as a profiler zone
+	s->time = GetTime();
+	s->interval = 1.0 / (double)sim_hz;
+
+	s->spatial_mode = spatial_mode;
+	s->grid_cell_size = grid_cell_size;
+	memcpy(s->auto_tune_ms, auto_tune_ms, sizeof(auto_tune_ms));
+
+	s->selected = 0;
+	s->selected_index = -1;
+	s->selected_target = -1;
+	s->selected_target_handle = 0;
+	s->selected_target_dist = 0.0f;
+
+	s->recording = false;
+	s->record_frames = 0;
+	s->record_bytes = 0;
+	s->record_raw_bytes = 0;
+	s->record_seconds = 0.0;
+
+	s->event_logging = false;
+	s->event_count = 0;
+
+	s->playback_frame = r->frame;
+	s->playback_frame_count = r->frame_count;
+
+	snapshot_buffer.Publish();
+}
+
+void Game::swap_entities(int a, int b) {
+	Entity e = entities[a];
+	entities[a] = entities[b];
+	entities[b] = e;
+
+	EntityTarget t = targets[a];
+	targets[a] = targets[b];
+	targets[b] = t;
+
+	EntityHandle h = handles[a];
+	handles[a] = handles[b];
+	handles[b] = h;
+
+	handle_table[handles[a] & ENTITY_HANDLE_SLOT_MASK] = (handles[a] & ~ENTITY_HANDLE_SLOT_MASK) | (Uint32)a;
+	handle_table[handles[b] & ENTITY_HANDLE_SLOT_MASK] = (handles[b] & ~ENTITY_HANDLE_SLOT_MASK) | (Uint32)b;
+}
+
+// Moves every entity converted this tick into its new type's range. An
+// entity moves one range at a time by swapping with the entity at the edge
+// of its range and shifting the boundary, so each move is O(1). Entities
+// whose type doesn't match their range all have a conversion record, so
+// anything misplaced that gets swapped around is settled through its own
+// record later.
+void Game::ApplyConversions() {
+	if (conversion_overflow) {
+		ReorderEntities();
+		return;
+	}
+
+	for (int k = 0; k < conversion_count; k++) {
+		int i = resolve(conversions[k].handle);
+
+		for (;;) {
+			int type = (int)entities[i].type;
+			int range = (i < type_start[1]) ? 0 : (i < type_start[2]) ? 1 : 2;
+			if (type == range) break;
+
+			if (type > range) {
+				int last = type_start[range + 1] - 1;
+				swap_entities(i, last);
+				type_start[range + 1]--;
+				i = last;
+			} else {
+				int first = type_start[range];
+				swap_entities(i, first);
+				type_start[range]++;
+				i = first;
+			}
+		}
+	}
+}
+
+struct CollisionQuery {
+	Game* game;
+	int i;
+};
+
+static void collide_job(void* user, int j) {
+	CollisionQuery* q = (CollisionQuery*) user;
+	q->game->collide(q->i, j);
+}
+
+void Game::queue_sound(EntityType type) {
+	AudioEvent ev = {type};
+	if (!audio_events.Push(&ev)) {
+		audio_events_dropped++;
+	}
+}
+
+void Game::collide(int i, int j) {
+	if (i == j) {
+		return;
+	}
+
+	Entity* e = &entities[i];
+	Entity* e2 = &entities[j];
+
+	float dx;
+	float dy;
+	offset(e->x, e->y, e2->x, e2->y, &dx, &dy);
+	if (!circle_vs_circle(0.0f, 0.0f, 16.0f, dx, dy, 16.0f)) {
+		return;
+	}
+
+	switch (e->type) {
+		case EntityType::ROCK: {
+			if (e2->type == EntityType::SCISSORS) {
+				record_conversion(i, j, e2->type);
+				e2->type = EntityType::ROCK;
+				queue_sound(EntityType::ROCK);
+			}
+			break;
+		}
+
+		case EntityType::PAPER: {
+			if (e2->type == EntityType::ROCK) {
+				record_conversion(i, j, e2->type);
+				e2->type = EntityType::PAPER;
+				queue_sound(EntityType::PAPER);
+			}
+			break;
+		}
+
+		case EntityType::SCISSORS: {
+			if (e2->type == EntityType::PAPER) {
+				record_conversion(i, j, e2->type);
+				e2->type = EntityType::SCISSORS;
+				queue_sound(EntityType::SCISSORS);
+			}
+			break;
+		}
+	}
+}
+
+struct TuneQuery {
+	Game* game;
+	const Entity* e;
+	int hits;
+};
+
+// Same test as collide(), without the side effects.
+static void tune_overlap(void* user, int j) {
+	TuneQuery* q = (TuneQuery*) user;
+	const Entity* e2 = &q->game->entities[j];
+
+	float dx;
+	float dy;
+	q->game->offset(q->e->x, q->e->y, e2->x, e2->y, &dx, &dy);
+	if (circle_vs_circle(0.0f, 0.0f, 16.0f, dx, dy, 16.0f)) {
+		q->hits++;
+	}
+}
+
+// Times every tunable backend on the current entities: an index build plus
+// a full query and a broadphase query for a sample of them, scaled up to
+// the whole population. The grid also tries a few cell sizes.
+void Game::AutoTune() {
+	SpatialMode old_mode = spatial_mode;
+	float old_cell_size = grid_cell_size;
+
+	int samples = SDL_min(auto_tune_samples, entity_count);
+	double to_ms = 1000.0 / (double)SDL_GetPerformanceFrequency();
+	double scale = (samples > 0) ? (double)entity_count / (double)samples : 0.0;
+	float reach = 32.0f + max_step(1.0f);
+
+	TuneQuery q = {this, nullptr, 0};
+
+	SpatialMode best_mode = old_mode;
+	double best_ms = INFINITY;
+	float best_cell_size = old_cell_size;
+
+	static const float cell_sizes[] = {16.0f, 32.0f, 64.0f, 128.0f, 256.0f};
+
+	for (int m = 0; m < (int)SpatialMode::COUNT; m++) {
+		auto_tune_ms[m] = 0.0;
+		if (!backends[m].tunable) continue;
+
+		spatial_mode = (SpatialMode)m;
+		int variants = (spatial_mode == SpatialMode::GRID) ? (int)ArrayLength(cell_sizes) : 1;
+
+		for (int v = 0; v < variants; v++) {
+			if (spatial_mode == SpatialMode::GRID) {
+				grid_cell_size = cell_sizes[v];
 			}
 
-			switch (e->type) {
-				case EntityType::ROCK: {
-					if (e2->type == EntityType::SCISSORS) {
-						e2->type = EntityType::ROCK;
-						play_sound(snd_rock);
+			Uint64 begin = SDL_GetPerformanceCounter();
+			BuildSpatialIndex();
+			Uint64 built = SDL_GetPerformanceCounter();
+			for (int s = 0; s < samples; s++) {
+				Entity* e = &entities[(int) ((Sint64)s * entity_count / samples)];
+				query_closest(e, search_radius());
+
+				q.e = e;
+				if (backend()->overlaps) {
+					query_overlaps(e->x, e->y, reach, tune_overlap, &q);
+				} else {
+					for (int j = 0; j < entity_count; j++) {
+						tune_overlap(&q, j);
 					}
-					break;
 				}
+			}
+			Uint64 end = SDL_GetPerformanceCounter();
 
-				case EntityType::PAPER: {
-					if (e2->type == EntityType::ROCK) {
-						e2->type = EntityType::PAPER;
-						play_sound(snd_paper);
-					}
-					break;
+			double ms = (double)(built - begin) * to_ms + (double)(end - built) * to_ms * scale;
+			if (auto_tune_ms[m] == 0.0 || ms < auto_tune_ms[m]) {
+				auto_tune_ms[m] = ms;
+			}
+			if (ms < best_ms) {
+				best_ms = ms;
+				best_mode = spatial_mode;
+				best_cell_size = grid_cell_size;
+			}
+		}
+
+		grid_cell_size = old_cell_size;
+	}
+
+	spatial_mode = best_mode;
+	if (best_mode == SpatialMode::GRID) {
+		grid_cell_size = best_cell_size;
+	}
+
+	// Whatever was built last isn't necessarily what was picked.
+	if (spatial_mode != SpatialMode::BRUTE_FORCE || compact_entities) {
+		BuildSpatialIndex();
+	}
+}
+
+void Game::Update(float delta) {
+	if (reorder_interval > 0 && ++reorder_ticks >= reorder_interval) {
+		PROFILE_ZONE(&profiler, "Reorder");
+		ReorderEntities();
+		reorder_ticks = 0;
+	}
+
+	if (auto_tune) {
+		double now = (double)SDL_GetPerformanceCounter() / (double)SDL_GetPerformanceFrequency();
+		if (now - auto_tune_last >= auto_tune_interval) {
+			PROFILE_ZONE(&profiler, "Auto Tune");
+			AutoTune();
+			auto_tune_last = now;
+		}
+	}
+
+	if (spatial_mode != SpatialMode::BRUTE_FORCE || compact_entities) {
+		PROFILE_ZONE(&profiler, "Index Build");
+		BuildSpatialIndex();
+	}
+
+	{
+		PROFILE_ZONE(&profiler, "Targeting");
+		UpdateTargets(delta);
+	}
+
+	{
+		PROFILE_ZONE(&profiler, "Movement");
+
+		// The shiver is a random walk, so it spreads with the square root
+		// of time and looks the same per second at any tick rate.
+		float shiver_scale = sqrtf(delta);
+
+		for (int i = 0; i < entity_count; i++) {
+			Entity* e = &entities[i];
+
+			EntityType prey = EntityType::SCISSORS;
+			// EntityType predator = EntityType::PAPER;
+			if (e->type == EntityType::PAPER) {
+				prey = EntityType::ROCK;
+				// predator = EntityType::SCISSORS;
+			} else if (e->type == EntityType::SCISSORS) {
+				prey = EntityType::PAPER;
+				// predator = EntityType::ROCK;
+			}
+
+			int target = resolve(targets[i].handle);
+			if (target >= 0) {
+				Entity* e2 = &entities[target];
+
+				float dx;
+				float dy;
+				offset(e->x, e->y, e2->x, e2->y, &dx, &dy);
+				normalize0(dx, dy, &dx, &dy);
+
+				float spd = entity_speed;
+				if (e2->type != prey) {
+					spd = entity_run_away_speed;
+					dx = -dx;
+					dy = -dy;
 				}
 
-				case EntityType::SCISSORS: {
-					if (e2->type == EntityType::PAPER) {
-						e2->type = EntityType::SCISSORS;
-						play_sound(snd_scissors);
-					}
-					break;
+				e->x += dx * spd * delta;
+				e->y += dy * spd * delta;
+
+				if (entity_shiver_multiplier > 0.0f) {
+					float shiver = spd * entity_shiver_multiplier * shiver_scale;
+					e->x += random.range(-shiver, shiver);
+					e->y += random.range(-shiver, shiver);
 				}
+
+				apply_boundary(e);
+			} else if (perception_radius > 0.0f && entity_shiver_multiplier > 0.0f) {
+				// Nothing in sight: wander until something comes into range.
+				float shiver = entity_speed * entity_shiver_multiplier * shiver_scale;
+				e->x += random.range(-shiver, shiver);
+				e->y += random.range(-shiver, shiver);
+
+				apply_boundary(e);
 			}
 		}
 	}
+
+	{
+		PROFILE_ZONE(&profiler, "Collisions");
+
+		if (tiles.ready && spatial_mode == SpatialMode::BRUTE_FORCE && tiled_brute_force) {
+			// Pairs found by the tiled scan, already in the order the plain loop visits them.
+			for (int b = 0; b < tiles.block_count; b++) {
+				TileBlock* block = &tiles.blocks[b];
+				for (int p = 0; p < block->pair_count; p++) {
+					collide(block->pairs[p * 2 + 0], block->pairs[p * 2 + 1]);
+				}
+			}
+			tiles.ready = false;
+		} else if (!backend()->overlaps) {
+			for (int i = 0; i < entity_count; i++) {
+				for (int j = 0; j < entity_count; j++) {
+					collide(i, j);
+				}
+			}
+		} else {
+			// The index was built before movement, so widen the reach by
+			// how far anything can have moved since.
+			float reach = 32.0f + max_step(delta);
+			for (int i = 0; i < entity_count; i++) {
+				CollisionQuery q = {this, i};
+				query_overlaps(entities[i].x, entities[i].y, reach, collide_job, &q);
+			}
+		}
+	}
+
+	{
+		PROFILE_ZONE(&profiler, "Conversions");
+		ApplyConversions();
+	}
+}
+
+static void snapshot_position(const Snapshot* snap, int i, float alpha, float* x, float* y) {
+	const Entity* e = &snap->entities[i];
+	*x = snap->prev[i * 2 + 0] + (e->x - snap->prev[i * 2 + 0]) * alpha;
+	*y = snap->prev[i * 2 + 1] + (e->y - snap->prev[i * 2 + 1]) * alpha;
 }
 
-void Game::Draw(float delta) {
+void Game::Draw(const Snapshot* snap, float alpha) {
 	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
 	SDL_RenderClear(renderer);
 
-	for (int i = 0; i < entity_count; i++) {
-		Entity* e = &entities[i];
+	float zoom = camera_zoom;
 
-		SDL_Rect src = {
-			(int)e->type * 32,
-			0,
-			32,
-			32
-		};
+	if (density_view) {
+		density.Draw(renderer, &render_jobs, snap, alpha, camera_x, camera_y, zoom, density_knee);
+	} else {
+		sprites.Draw(renderer, &render_jobs, tex_entities, snap, alpha, camera_x, camera_y, zoom);
+	}
 
-		SDL_Rect dest = {
-			(int) (e->x - 16.0f - camera_x),
-			(int) (e->y - 16.0f - camera_y),
-			32,
-			32
-		};
+	int sel = snap->selected_index;
+	if (sel >= 0) {
+		float x;
+		float y;
+		snapshot_position(snap, sel, alpha, &x, &y);
+
+		int target = snap->selected_target;
+		if (target >= 0) {
+			float tx;
+			float ty;
+			snapshot_position(snap, target, alpha, &tx, &ty);
+			SDL_SetRenderDrawColor(renderer, 255, 255, 0, 255);
+			SDL_RenderDrawLine(renderer,
+							   (int) ((x - camera_x) * zoom), (int) ((y - camera_y) * zoom),
+							   (int) ((tx - camera_x) * zoom), (int) ((ty - camera_y) * zoom));
+		}
 
-		SDL_RenderCopy(renderer, tex_entities, &src, &dest);
+		SDL_Rect rect = {
+			(int) ((x - 18.0f - camera_x) * zoom),
+			(int) ((y - 18.0f - camera_y) * zoom),
+			(int) (36.0f * zoom),
+			(int) (36.0f * zoom)
+		};
+		SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+		SDL_RenderDrawRect(renderer, &rect);
 	}
 
 	ImGui::Render();
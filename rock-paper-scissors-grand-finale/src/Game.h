@@ -2,8 +2,25 @@
 
 #include <SDL.h>
 #include <SDL_mixer.h>
+#include <math.h>
 
 #include "xoshiro256plusplus.h"
+#include "Profiler.h"
+#include "Histogram.h"
+#include "SpatialGrid.h"
+#include "Quadtree.h"
+#include "KdTree.h"
+#include "Kernels.h"
+#include "FlowField.h"
+#include "JobSystem.h"
+#include "SpatialBackend.h"
+#include "TiledBruteForce.h"
+#include "TripleBuffer.h"
+#include "MessageQueue.h"
+#include "DensityRenderer.h"
+#include "SpriteBatch.h"
+#include "Trajectory.h"
+#include "EventLog.h"
 
 #define GAME_W 640
 #define GAME_H 480
@@ -21,22 +38,295 @@ struct Entity {
 	float y;
 };
 
+enum struct SpatialMode {
+	BRUTE_FORCE,
+	GRID,
+	QUADTREE,
+	KD_TREE,
+	FLOW_FIELD,
+	BARNES_HUT,
+
+	COUNT
+};
+
+// What happens to entities that leave [0, map_w] x [0, map_h].
+enum struct BoundaryMode {
+	NONE,
+	CLAMP,
+	REFLECT,
+	TORUS,
+
+	COUNT
+};
+
+extern const char* boundary_mode_names[(int)BoundaryMode::COUNT];
+
+// Stable reference to an entity: 24-bit slot in the handle table, 8-bit
+// generation on top. Entities can be reordered freely, the table follows
+// them. 0 is never a valid handle.
+typedef Uint32 EntityHandle;
+
+#define ENTITY_HANDLE_SLOT_BITS 24
+#define ENTITY_HANDLE_SLOT_MASK ((1u << ENTITY_HANDLE_SLOT_BITS) - 1)
+#define ENTITY_MAX_COUNT (1 << ENTITY_HANDLE_SLOT_BITS)
+
+// Cached nearest enemy. Every entity moves at most a known distance per
+// tick, so `bound` shrinks by twice that each tick; while the target is
+// still closer than `bound` no other enemy can have overtaken it.
+struct EntityTarget {
+	EntityHandle handle;  // 0 = no target
+	float dist;           // distance to the target when it was last checked
+	float bound;          // lower bound on the distance to every other enemy
+};
+
+// Local searches reach this many ticks of decay past the target, so the
+// bound they leave behind stays ahead of it for a few ticks.
+#define TARGET_CACHE_SLACK 4.0f
+
+struct Conversion {
+	EntityHandle handle;
+	EntityType from;
+};
+
+// Everything the UI can change about the simulation. The render thread
+// edits its own copy and sends it over whole.
+struct SimSettings {
+	int init_entity_count;
+	float map_w;
+	float map_h;
+	float entity_speed;
+	float entity_run_away_speed;
+	float entity_shiver_multiplier;
+	float perception_radius;
+	BoundaryMode boundary_mode;
+	SpatialMode spatial_mode;
+	float grid_cell_size;
+	bool compact_entities;
+	bool tiled_brute_force;
+	float flow_cell_size;
+	float barnes_hut_theta;
+	int drift_samples;
+	bool auto_tune;
+	float auto_tune_interval;
+	bool target_cache;
+	int retarget_budget;
+	int reorder_interval;
+	int sim_hz;
+	bool paused;
+};
+
+enum struct SimMessageType {
+	SETTINGS,
+	RESET,
+	SELECT,    // entity closest to (x, y)
+	DESELECT,
+	RECORD_START,  // trajectory to `path`
+	RECORD_STOP,
+	SEEK,          // playback to `frame`
+	EVENT_LOG_START,  // conversion log to `path`
+	EVENT_LOG_STOP,
+};
+
+struct SimMessage {
+	SimMessageType type;
+	SimSettings settings;
+	float x;
+	float y;
+	char path[256];
+	int frame;
+};
+
+#define SIM_MESSAGE_CAPACITY 64
+
+// Update times (seconds) of ticks not yet added to the histogram.
+#define UPDATE_TIME_CAPACITY 1024
+
+// A conversion that should make a sound, from the simulation to the audio
+// thread.
+struct AudioEvent {
+	EntityType type;  // what the entity turned into
+};
+
+#define AUDIO_EVENT_CAPACITY 1024
+
+// The same sound won't restart more often than this (seconds).
+#define SOUND_MIN_INTERVAL 0.05
+
+// One simulation tick as the render thread sees it. Filled by the
+// simulation thread, read-only once published.
+struct Snapshot {
+	Entity* entities;
+	int entity_count;
+	int entity_capacity;
+	Uint64 tick;
+	double update_took;  // seconds, 0 if the tick was skipped
+	double time;         // when it was published
+	double interval;     // seconds per tick
+
+	// Positions one tick earlier, x and y per entity, for drawing in between.
+	// On a torus they're the image closest to the current position.
+	float* prev;
+
+	// The auto-tuner picks these on the simulation side.
+	SpatialMode spatial_mode;
+	float grid_cell_size;
+	double auto_tune_ms[(int)SpatialMode::COUNT];
+
+	EntityHandle selected;
+	int selected_index;   // into `entities`, -1 = nothing selected
+	int selected_target;  // -1 = no target
+	EntityHandle selected_target_handle;
+	float selected_target_dist;
+
+	bool recording;
+	int record_frames;
+	Uint64 record_bytes;
+	Uint64 record_raw_bytes;
+	double record_seconds;
+
+	bool event_logging;
+	Uint64 event_count;
+
+	int playback_frame;
+	int playback_frame_count;  // frames that decode, 0 outside playback
+};
+
 struct Game {
 	Entity* entities;
 	int entity_count;
 	int init_entity_count = 1000;
 
+	// Entities are kept sorted by type: type `t` occupies
+	// [type_start[t], type_start[t + 1]). Conversions move entities between
+	// ranges once per tick, in ApplyConversions.
+	int type_start[4];
+
+	EntityHandle* handles;  // handle of the entity at each index
+	Uint32* handle_table;   // slot -> generation << 24 | index
+	Uint32 handle_generation;
+	EntityHandle selected;
+
+	EntityTarget* targets;
+	Conversion* conversions;
+	Entity* conversion_entities;  // where each conversion happened, for conversion_grid
+	SpatialGrid conversion_grid;
+	int* retarget_queue;
+	int conversion_count;
+	bool conversion_overflow;
+
+	SpatialMode spatial_mode = SpatialMode::GRID;
+	SpatialBackend backends[(int)SpatialMode::COUNT];
+	SpatialGrid grid;
+	float grid_cell_size = 64.0f;
+	Quadtree quadtree;
+	KdTree kd_trees[3]; // one per EntityType
+
+	// Brute force scans an 8-byte quantized copy of the entities instead.
+	bool compact_entities;
+	PackedEntity* packed;
+	int packed_capacity;
+	PackedBounds packed_bounds;
+
+	// Brute force in cache-sized tiles, finding targets and collision pairs
+	// in one pass.
+	bool tiled_brute_force;
+	TiledBruteForce tiles;
+
+	FlowField flow_field;
+	float flow_cell_size = 16.0f;
+	float barnes_hut_theta = 0.5f;
+
+	// Every `auto_tune_interval` seconds, times the exact backends (and a
+	// few grid cell sizes) on the live state and switches to the fastest.
+	bool auto_tune;
+	float auto_tune_interval = 5.0f;
+	int auto_tune_samples = 1'024;
+	double auto_tune_last;
+	double auto_tune_ms[(int)SpatialMode::COUNT];  // estimated cost per tick, 0 = not timed
+
+	// Approximate modes compare this many entities with exact targeting per tick.
+	int drift_samples = 64;
+	int drift_cursor;
+
+	bool target_cache = true;
+	int retarget_budget = 0;  // full queries per tick, 0 = no limit
+	int target_local_rings = 2;
+	int retarget_cursor;
+	bool targets_reset;
+
+	// Within their type range, entities are sorted along a Z-order curve
+	// every `reorder_interval` ticks (0 = never) so neighbors in space are
+	// neighbors in memory.
+	int reorder_interval = 60;
+	int reorder_ticks;
+	Uint32* reorder_keys;      // 2 * entity_count
+	int* reorder_indices;      // 2 * entity_count
+	Entity* entities_scratch;
+	EntityTarget* targets_scratch;
+	EntityHandle* handles_scratch;
+
 	float camera_x;
 	float camera_y;
+	float camera_zoom = 1.0f;  // screen pixels per world pixel
 	float map_w = 2000.0f;
 	float map_h = 2000.0f;
+	BoundaryMode boundary_mode = BoundaryMode::NONE;
 	float entity_speed = 1.0f;
 	float entity_run_away_speed = 0.25f;
 	float entity_shiver_multiplier = 0.5f;
 
+	// How far entities can see, 0 for the whole map. Entities with no enemy
+	// in range just wander.
+	float perception_radius = 0.0f;
+
 	xoshiro256plusplus random;
 
 	bool paused;
+	Uint64 tick;
+	int sim_hz = GAME_FPS;
+	float* prev_positions;  // x and y per handle slot, before the current tick
+	TrajectoryWriter trajectory;
+	EventLog event_log;
+
+	// Viewer mode plays a recorded trajectory instead of simulating. The
+	// simulation thread decodes frames and publishes them as snapshots, one
+	// frame ahead of the one on screen.
+	const char* view_path;
+	bool viewing;
+	TrajectoryReader playback;   // simulation thread only
+	int playback_target;         // simulation thread only
+	int playback_shown;          // simulation thread only
+	int playback_seek;           // render thread only, sent with SEEK
+	int playback_scrub;          // render thread only
+	bool playback_scrubbing;     // render thread only
+
+	// The simulation runs on its own thread and publishes a Snapshot every
+	// tick; the render thread draws the newest one and sends UI edits back
+	// as SimMessages. Without a thread (Emscripten) Frame runs a tick inline.
+	SDL_Thread* sim_thread;
+	std::atomic<bool> sim_quit;
+	Snapshot snapshots[3];
+	TripleBuffer snapshot_buffer;
+	MessageQueue sim_messages;
+	MessageQueue update_times;   // every tick's update time, drained by Frame
+	SimSettings ui_settings;      // render thread only
+	bool ui_settings_dirty;
+	Uint64 drawn_tick;
+	double sim_accumulator;       // inline ticks only
+
+	// Render thread only.
+	int render_fps = GAME_FPS;
+	bool interpolate = true;
+	bool density_view;
+	float density_knee = 2.0f;
+	DensityRenderer density;
+	SpriteBatch sprites;
+
+	// ParallelFor takes one caller at a time and `jobs` belongs to the
+	// simulation, so drawing has its own pool. The cores are split between
+	// the two (see Init).
+	JobSystem render_jobs;
+
 	SDL_Window* window;
 	SDL_Renderer* renderer;
 	bool quit;
@@ -51,13 +341,115 @@ struct Game {
 	Mix_Chunk* snd_paper;
 	Mix_Chunk* snd_scissors;
 
+	// Mixer calls lock the audio device, so the simulation only queues
+	// events and the audio thread plays them. Without a thread (Emscripten)
+	// Frame plays them.
+	SDL_Thread* audio_thread;
+	std::atomic<bool> audio_quit;
+	SDL_sem* audio_wake;
+	MessageQueue audio_events;
+	int audio_events_dropped;          // simulation thread only
+	double sound_last_played[3];       // audio thread only
+
+	Profiler profiler;
+	JobSystem jobs;
+	bool profiler_window_open;
+
+	Histogram frame_hist;
+	Histogram update_hist;
+	Histogram draw_hist;
+	int trace_frames = 300;
+	int trace_on_start_frames;
+	char record_path[256] = "trajectory.rtrj";
+	bool record_on_start;
+	char event_log_path[256] = "conversions.rcev";
+	bool event_log_on_start;
+	const char* trace_path;
+
 	void Init();
 	void Quit();
 	void Run();
 	void Frame();
 	void Update(float delta);
-	void Draw(float delta);
+	void Draw(const Snapshot* snap, float alpha);
+	void SimStep(float delta);
+	void PublishSnapshot(double update_took);
+	void PlaybackStep();
+	void PublishPlayback();
+	SimSettings GetSettings() const;
+	void ApplySettings(const SimSettings& s);
+	void SendToSim(SimMessageType type, float x, float y);
+	void PlayQueuedSounds();
 	void Reset();
+	void FreeWorld();
+	void UpdateTargets(float delta);
+	void BuildSpatialIndex();
+	void ReorderEntities();
+	void ApplyConversions();
+	void MeasureTargetDrift();
+	void AutoTune();
+	void RegisterBackend(SpatialMode mode, const SpatialBackend& backend);
+	void CaptureTrace(int frames);
+	void ResetFrameStats();
+	void DumpFrameStats();
+
+	// Index of the entity, or -1 if the handle is stale.
+	int resolve(EntityHandle h) const {
+		Uint32 slot = h & ENTITY_HANDLE_SLOT_MASK;
+		if (slot >= (Uint32)entity_count) return -1;
+		Uint32 entry = handle_table[slot];
+		return ((entry ^ h) >> ENTITY_HANDLE_SLOT_BITS) ? -1 : (int)(entry & ENTITY_HANDLE_SLOT_MASK);
+	}
+
+	// Shortest offset from a to b, across the edges on a torus.
+	void offset(float ax, float ay, float bx, float by, float* dx, float* dy) const {
+		*dx = bx - ax;
+		*dy = by - ay;
+		if (boundary_mode == BoundaryMode::TORUS) {
+			if (*dx > map_w * 0.5f) *dx -= map_w;
+			else if (*dx < -map_w * 0.5f) *dx += map_w;
+			if (*dy > map_h * 0.5f) *dy -= map_h;
+			else if (*dy < -map_h * 0.5f) *dy += map_h;
+		}
+	}
+
+	float distance(float ax, float ay, float bx, float by) const {
+		float dx;
+		float dy;
+		offset(ax, ay, bx, by, &dx, &dy);
+		return sqrtf(dx * dx + dy * dy);
+	}
+
+	const SpatialBackend* backend() const {
+		return &backends[(int)spatial_mode];
+	}
+
+	// Modes whose queries don't give a bound the target cache can use.
+	bool approximate_targets() const {
+		return backend()->approximate;
+	}
+
+	// The most anything can move in a tick: the step plus the shiver on both axes.
+	float max_step(float delta) const {
+		float spd = fmaxf(fabsf(entity_speed), fabsf(entity_run_away_speed));
+		return spd * delta + spd * fmaxf(entity_shiver_multiplier, 0.0f) * sqrtf(delta) * 1.4142136f;
+	}
+
+	float search_radius() const {
+		return (perception_radius > 0.0f) ? perception_radius : INFINITY;
+	}
 
 	Entity* find_closest(Entity* e);
+	ClosestResult query_closest(const Entity* e, float radius);
+	ClosestResult query_closest_wrapped(const Entity* e, float radius, int max_rings);
+	ClosestResult query_point(EntityType type, float px, float py, float radius, int max_rings);
+	bool query_closest_local(const Entity* e, float radius, ClosestResult* result);
+	void for_each_conversion_near(float px, float py, float radius, OverlapFn fn, void* user);
+	void query_overlaps(float px, float py, float radius, OverlapFn fn, void* user);
+	void collide(int i, int j);
+	void queue_sound(EntityType type);
+	void record_conversion(int predator, int victim, EntityType from);
+	void swap_entities(int a, int b);
+	void apply_boundary(Entity* e);
+	void select_entity_at(float x, float y);
 };
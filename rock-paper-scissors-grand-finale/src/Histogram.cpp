@@ -0,0 +1,71 @@
+#include "Histogram.h"
+
+#include <string.h>
+
+void Histogram::Clear() {
+	memset(buckets, 0, sizeof(buckets));
+	count = 0;
+	over_budget = 0;
+	max = 0.0;
+	total = 0.0;
+}
+
+void Histogram::Add(double seconds) {
+	int i = (int) (seconds * (1000.0 / HISTOGRAM_BUCKET_MS));
+	if (i < 0) i = 0;
+	if (i >= HISTOGRAM_BUCKETS) i = HISTOGRAM_BUCKETS - 1;
+
+	buckets[i]++;
+	count++;
+	total += seconds;
+	if (seconds > max) max = seconds;
+
+	// 5% slack so on-time frames with a bit of pacing jitter don't count.
+	if (budget > 0.0 && seconds > budget * 1.05) {
+		over_budget++;
+	}
+}
+
+double Histogram::Percentile(double p) {
+	if (count == 0) {
+		return 0.0;
+	}
+
+	Uint32 target = (Uint32) (p * (double)count);
+	if (target >= count) target = count - 1;
+
+	Uint32 seen = 0;
+	for (int i = 0; i < HISTOGRAM_BUCKETS - 1; i++) {
+		seen += buckets[i];
+		if (seen > target) {
+			double upper = (double)(i + 1) * HISTOGRAM_BUCKET_MS / 1000.0;
+			return (upper < max) ? upper : max;
+		}
+	}
+
+	return max;
+}
+
+void write_histograms_csv(FILE* f, Histogram** histograms, const char** names, int count) {
+	fprintf(f, "bucket_ms");
+	for (int j = 0; j < count; j++) {
+		fprintf(f, ",%s", names[j]);
+	}
+	fprintf(f, "\n");
+
+	for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		bool empty = true;
+		for (int j = 0; j < count; j++) {
+			if (histograms[j]->buckets[i]) empty = false;
+		}
+		if (empty) {
+			continue;
+		}
+
+		fprintf(f, "%.1f", (double)i * HISTOGRAM_BUCKET_MS);
+		for (int j = 0; j < count; j++) {
+			fprintf(f, ",%u", histograms[j]->buckets[i]);
+		}
+		fprintf(f, "\n");
+	}
+}
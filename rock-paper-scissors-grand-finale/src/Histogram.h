@@ -0,0 +1,27 @@
+#pragma once
+
+#include <SDL.h>
+#include <stdio.h>
+
+// 0.1 ms buckets up to 50 ms, the last bucket takes everything slower.
+#define HISTOGRAM_BUCKET_MS 0.1
+#define HISTOGRAM_BUCKETS 500
+
+// Fixed-bucket timing histogram. Adding a sample is a couple of arithmetic
+// ops and an increment, so it stays on in release builds.
+struct Histogram {
+	Uint32 buckets[HISTOGRAM_BUCKETS];
+	Uint32 count;
+	Uint32 over_budget;
+	double budget;
+	double max;
+	double total;
+
+	void Clear();
+	void Add(double seconds);
+
+	// p in [0, 1], returns seconds (upper edge of the bucket).
+	double Percentile(double p);
+};
+
+void write_histograms_csv(FILE* f, Histogram** histograms, const char** names, int count);
@@ -0,0 +1,152 @@
+#include "JobSystem.h"
+
+#include "Profiler.h"
+
+static void run_chunks(JobSystem* jobs) {
+	PROFILE_ZONE(jobs->profiler, jobs->name);
+
+	for (;;) {
+		int begin = jobs->next.fetch_add(jobs->grain);
+		if (begin >= jobs->count) break;
+
+		int end = SDL_min(begin + jobs->grain, jobs->count);
+		jobs->fn(jobs->user, begin, end);
+
+		if (jobs->chunks_left.fetch_sub(1) == 1) {
+			SDL_LockMutex(jobs->mutex);
+			SDL_CondBroadcast(jobs->done);
+			SDL_UnlockMutex(jobs->mutex);
+		}
+	}
+}
+
+static int worker_thread(void* data) {
+	JobSystem* jobs = (JobSystem*) data;
+
+	int index = jobs->profiler->RegisterThread("Worker");
+	if (index >= 0) {
+		ProfilerThread* t = &jobs->profiler->threads[index];
+		SDL_snprintf(t->name, sizeof(t->name), "Worker %d", index);
+	}
+
+	Uint32 seen = 0;
+	SDL_LockMutex(jobs->mutex);
+	for (;;) {
+		while (!jobs->quit && jobs->generation == seen) {
+			SDL_CondWait(jobs->wake, jobs->mutex);
+		}
+		if (jobs->quit) break;
+
+		seen = jobs->generation;
+		jobs->busy++;
+		SDL_UnlockMutex(jobs->mutex);
+
+		run_chunks(jobs);
+
+		SDL_LockMutex(jobs->mutex);
+		jobs->busy--;
+		SDL_CondBroadcast(jobs->done);
+	}
+	SDL_UnlockMutex(jobs->mutex);
+
+	return 0;
+}
+
+void JobSystem::Init(Profiler* _profiler, int threads) {
+	profiler = _profiler;
+	thread_count = 0;
+	mutex = nullptr;
+	wake = nullptr;
+	done = nullptr;
+	quit = false;
+	generation = 0;
+	busy = 0;
+	next = 0;
+	chunks_left = 0;
+
+#ifdef __EMSCRIPTEN__
+	threads = 0;
+#endif
+
+	if (threads < 0) {
+		threads = SDL_GetCPUCount() - 1;
+	}
+	threads = SDL_min(SDL_max(threads, 0), JOB_MAX_THREADS);
+	if (threads == 0) {
+		return;
+	}
+
+	mutex = SDL_CreateMutex();
+	wake = SDL_CreateCond();
+	done = SDL_CreateCond();
+	if (!mutex || !wake || !done) {
+		SDL_Log("Couldn't create job system sync objects: %s", SDL_GetError());
+		return;
+	}
+
+	for (int i = 0; i < threads; i++) {
+		SDL_Thread* t = SDL_CreateThread(worker_thread, "Worker", this);
+		if (!t) {
+			SDL_Log("Couldn't create worker thread: %s", SDL_GetError());
+			break;
+		}
+		this->threads[thread_count++] = t;
+	}
+}
+
+void JobSystem::Quit() {
+	if (thread_count > 0) {
+		SDL_LockMutex(mutex);
+		quit = true;
+		SDL_CondBroadcast(wake);
+		SDL_UnlockMutex(mutex);
+
+		for (int i = 0; i < thread_count; i++) {
+			SDL_WaitThread(threads[i], nullptr);
+		}
+		thread_count = 0;
+	}
+
+	if (mutex) SDL_DestroyMutex(mutex);
+	if (wake) SDL_DestroyCond(wake);
+	if (done) SDL_DestroyCond(done);
+	mutex = nullptr;
+	wake = nullptr;
+	done = nullptr;
+}
+
+void JobSystem::ParallelFor(const char* _name, int _count, int _grain, JobFunction _fn, void* _user) {
+	if (_count <= 0) return;
+	if (_grain < 1) _grain = 1;
+
+	if (thread_count == 0 || _count <= _grain) {
+		_fn(_user, 0, _count);
+		return;
+	}
+
+	SDL_LockMutex(mutex);
+
+	// A worker that woke up late may still be looking at the last loop.
+	while (busy > 0) {
+		SDL_CondWait(done, mutex);
+	}
+
+	name = _name;
+	fn = _fn;
+	user = _user;
+	count = _count;
+	grain = _grain;
+	next = 0;
+	chunks_left = (_count + _grain - 1) / _grain;
+	generation++;
+	SDL_CondBroadcast(wake);
+	SDL_UnlockMutex(mutex);
+
+	run_chunks(this);
+
+	SDL_LockMutex(mutex);
+	while (chunks_left.load() > 0) {
+		SDL_CondWait(done, mutex);
+	}
+	SDL_UnlockMutex(mutex);
+}
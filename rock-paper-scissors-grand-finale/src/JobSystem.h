@@ -0,0 +1,43 @@
+#pragma once
+
+#include <SDL.h>
+#include <atomic>
+
+struct Profiler;
+
+#define JOB_MAX_THREADS 16
+
+typedef void (*JobFunction)(void* user, int begin, int end);
+
+// Fixed pool of worker threads for data-parallel loops. The calling thread
+// takes chunks too, so with no workers (or on Emscripten) loops just run
+// inline.
+struct JobSystem {
+	Profiler* profiler;
+	SDL_Thread* threads[JOB_MAX_THREADS];
+	int thread_count;
+
+	SDL_mutex* mutex;
+	SDL_cond* wake;
+	SDL_cond* done;
+	bool quit;
+	Uint32 generation;  // bumped for every loop
+	int busy;           // workers inside a loop
+
+	// Current loop, only written while no worker is busy.
+	const char* name;
+	JobFunction fn;
+	void* user;
+	int count;
+	int grain;
+	std::atomic<int> next;
+	std::atomic<int> chunks_left;
+
+	// `threads` < 0 picks one per core, minus the calling thread.
+	void Init(Profiler* _profiler, int threads);
+	void Quit();
+
+	// Calls fn(user, begin, end) over [0, count) in chunks of `grain` and
+	// returns when all of them are done.
+	void ParallelFor(const char* _name, int _count, int _grain, JobFunction _fn, void* _user);
+};
@@ -0,0 +1,170 @@
+#include "KdTree.h"
+
+#include "Game.h"
+
+#include <stdlib.h>
+#include <algorithm>
+
+static void build_range(KdPoint* points, int lo, int hi, int depth) {
+	while (hi - lo > KDTREE_LEAF_SIZE) {
+		int mid = (lo + hi) / 2;
+		if (depth & 1) {
+			std::nth_element(points + lo, points + mid, points + hi, [](const KdPoint& a, const KdPoint& b) { return a.y < b.y; });
+		} else {
+			std::nth_element(points + lo, points + mid, points + hi, [](const KdPoint& a, const KdPoint& b) { return a.x < b.x; });
+		}
+
+		build_range(points, lo, mid, depth + 1);
+		lo = mid + 1;
+		depth++;
+	}
+}
+
+void KdTree::Build(const Entity* entities, int first, int last) {
+	count = last - first;
+	if (count > capacity) {
+		free(points);
+		capacity = count;
+		points = (KdPoint*) malloc(capacity * sizeof(KdPoint));
+		if (!points) {
+			SDL_Log("Out of memory.");
+			exit(1);
+		}
+	}
+
+	for (int i = first; i < last; i++) {
+		KdPoint* p = &points[i - first];
+		p->x = entities[i].x;
+		p->y = entities[i].y;
+		p->index = i;
+	}
+
+	build_range(points, 0, count, 0);
+}
+
+void KdTree::Free() {
+	free(points);
+	points = nullptr;
+	count = 0;
+	capacity = 0;
+}
+
+void KdTree::FindClosest(float px, float py, float* _best, float* _second, int* _index) const {
+	struct Range {
+		int lo;
+		int hi;
+		int depth;
+		float min_dist;
+	};
+
+	float best = *_best;
+	float second = *_second;
+	int index = *_index;
+
+	Range stack[128];
+	int top = 0;
+	if (count > 0) {
+		stack[top++] = {0, count, 0, 0.0f};
+	}
+
+	while (top > 0) {
+		Range r = stack[--top];
+		if (r.min_dist >= second) continue;
+
+		if (r.hi - r.lo <= KDTREE_LEAF_SIZE) {
+			for (int k = r.lo; k < r.hi; k++) {
+				const KdPoint* p = &points[k];
+				float dx = p->x - px;
+				float dy = p->y - py;
+				float d = dx * dx + dy * dy;
+				if (d < best) {
+					second = best;
+					best = d;
+					index = p->index;
+				} else if (d < second) {
+					second = d;
+				}
+			}
+			continue;
+		}
+
+		int mid = (r.lo + r.hi) / 2;
+		const KdPoint* p = &points[mid];
+
+		float dx = p->x - px;
+		float dy = p->y - py;
+		float d = dx * dx + dy * dy;
+		if (d < best) {
+			second = best;
+			best = d;
+			index = p->index;
+		} else if (d < second) {
+			second = d;
+		}
+
+		float diff = (r.depth & 1) ? (py - p->y) : (px - p->x);
+		float far_dist = (diff * diff > r.min_dist) ? diff * diff : r.min_dist;
+
+		// Far side first so the near side is popped (and tightens `second`) first.
+		if (diff < 0.0f) {
+			stack[top++] = {mid + 1, r.hi, r.depth + 1, far_dist};
+			stack[top++] = {r.lo, mid, r.depth + 1, r.min_dist};
+		} else {
+			stack[top++] = {r.lo, mid, r.depth + 1, far_dist};
+			stack[top++] = {mid + 1, r.hi, r.depth + 1, r.min_dist};
+		}
+	}
+
+	*_best = best;
+	*_second = second;
+	*_index = index;
+}
+
+void KdTree::ForEachNear(float px, float py, float radius, OverlapFn fn, void* user) const {
+	struct Range {
+		int lo;
+		int hi;
+		int depth;
+	};
+
+	float radius_sq = radius * radius;
+
+	Range stack[128];
+	int top = 0;
+	if (count > 0) {
+		stack[top++] = {0, count, 0};
+	}
+
+	while (top > 0) {
+		Range r = stack[--top];
+
+		if (r.hi - r.lo <= KDTREE_LEAF_SIZE) {
+			for (int k = r.lo; k < r.hi; k++) {
+				const KdPoint* p = &points[k];
+				float dx = p->x - px;
+				float dy = p->y - py;
+				if (dx * dx + dy * dy <= radius_sq) {
+					fn(user, p->index);
+				}
+			}
+			continue;
+		}
+
+		int mid = (r.lo + r.hi) / 2;
+		const KdPoint* p = &points[mid];
+
+		float dx = p->x - px;
+		float dy = p->y - py;
+		if (dx * dx + dy * dy <= radius_sq) {
+			fn(user, p->index);
+		}
+
+		float diff = (r.depth & 1) ? (py - p->y) : (px - p->x);
+		if (diff - radius <= 0.0f) {
+			stack[top++] = {r.lo, mid, r.depth + 1};
+		}
+		if (diff + radius >= 0.0f) {
+			stack[top++] = {mid + 1, r.hi, r.depth + 1};
+		}
+	}
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "SpatialGrid.h"
+
+struct Entity;
+
+#define KDTREE_LEAF_SIZE 8
+
+struct KdPoint {
+	float x;
+	float y;
+	int index;
+};
+
+// Static k-d tree over a range of entities (one type's), packed into a flat array
+// with no pointers: the middle element of every range is the node, the
+// halves on either side are its subtrees. The split axis alternates with
+// depth, ranges of KDTREE_LEAF_SIZE or less are scanned linearly.
+struct KdTree {
+	KdPoint* points;
+	int count;
+	int capacity;
+
+	void Build(const Entity* entities, int first, int last);
+	void Free();
+
+	// Tightens `best`/`second` (squared distances) and sets `index` if
+	// something closer than `best` is found. Pass the results of a previous
+	// search of another tree to terminate early.
+	void FindClosest(float px, float py, float* best, float* second, int* index) const;
+
+	// Every point within `radius` of (px, py).
+	void ForEachNear(float px, float py, float radius, OverlapFn fn, void* user) const;
+};
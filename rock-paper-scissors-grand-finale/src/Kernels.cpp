@@ -0,0 +1,174 @@
+#include "Kernels.h"
+
+#include "Game.h"
+
+#include <math.h>
+
+#ifdef KERNELS_SSE2
+#include <emmintrin.h>
+#endif
+
+PackedBounds pack_entities(const Entity* entities, int count, PackedEntity* out) {
+	float min_x = 0.0f;
+	float min_y = 0.0f;
+	float max_x = 0.0f;
+	float max_y = 0.0f;
+	if (count > 0) {
+		min_x = max_x = entities[0].x;
+		min_y = max_y = entities[0].y;
+	}
+	for (int i = 1; i < count; i++) {
+		min_x = fminf(min_x, entities[i].x);
+		min_y = fminf(min_y, entities[i].y);
+		max_x = fmaxf(max_x, entities[i].x);
+		max_y = fmaxf(max_y, entities[i].y);
+	}
+
+	PackedBounds bounds;
+	bounds.x = min_x;
+	bounds.y = min_y;
+	bounds.step_x = (max_x > min_x) ? (max_x - min_x) / 65535.0f : 1.0f;
+	bounds.step_y = (max_y > min_y) ? (max_y - min_y) / 65535.0f : 1.0f;
+
+	float inv_x = 1.0f / bounds.step_x;
+	float inv_y = 1.0f / bounds.step_y;
+	for (int i = 0; i < count; i++) {
+		const Entity* e = &entities[i];
+		PackedEntity* p = &out[i];
+		p->x = (Uint16) fminf((e->x - min_x) * inv_x + 0.5f, 65535.0f);
+		p->y = (Uint16) fminf((e->y - min_y) * inv_y + 0.5f, 65535.0f);
+		p->info = ((Uint32)e->type << 24) | ((Uint32)i & PACKED_INDEX_MASK);
+	}
+
+	return bounds;
+}
+
+void closest_in_range(const Entity* entities, int first, int last, float px, float py,
+					  float* _best, float* _second, int* _index) {
+	float best = *_best;
+	float second = *_second;
+	int index = *_index;
+
+	for (int i = first; i < last; i++) {
+		const Entity* e2 = &entities[i];
+
+		float dx = e2->x - px;
+		float dy = e2->y - py;
+		float d = dx * dx + dy * dy;
+		if (d < best) {
+			second = best;
+			best = d;
+			index = i;
+		} else if (d < second) {
+			second = d;
+		}
+	}
+
+	*_best = best;
+	*_second = second;
+	*_index = index;
+}
+
+void closest_in_range_packed_scalar(const PackedEntity* packed, const PackedBounds& bounds, int first, int last,
+									float px, float py, float* _best, float* _second, int* _index) {
+	float best = *_best;
+	float second = *_second;
+	int index = *_index;
+
+	float base_x = bounds.x - px;
+	float base_y = bounds.y - py;
+
+	for (int i = first; i < last; i++) {
+		const PackedEntity* p = &packed[i];
+
+		float dx = base_x + (float)p->x * bounds.step_x;
+		float dy = base_y + (float)p->y * bounds.step_y;
+		float d = dx * dx + dy * dy;
+		if (d < best) {
+			second = best;
+			best = d;
+			index = i;
+		} else if (d < second) {
+			second = d;
+		}
+	}
+
+	*_best = best;
+	*_second = second;
+	*_index = index;
+}
+
+#ifdef KERNELS_SSE2
+
+void closest_in_range_packed(const PackedEntity* packed, const PackedBounds& bounds, int first, int last,
+							 float px, float py, float* best, float* second, int* index) {
+	int simd_last = first + ((last - first) & ~3);
+
+	// Four lanes, each keeping its own best, second best and best index.
+	__m128 lane_best = _mm_set1_ps(INFINITY);
+	__m128 lane_second = _mm_set1_ps(INFINITY);
+	__m128i lane_index = _mm_set1_epi32(-1);
+
+	__m128 base_x = _mm_set1_ps(bounds.x - px);
+	__m128 base_y = _mm_set1_ps(bounds.y - py);
+	__m128 step_x = _mm_set1_ps(bounds.step_x);
+	__m128 step_y = _mm_set1_ps(bounds.step_y);
+	__m128i low16 = _mm_set1_epi32(0xFFFF);
+	__m128i cur = _mm_setr_epi32(first, first + 1, first + 2, first + 3);
+	__m128i four = _mm_set1_epi32(4);
+
+	for (int i = first; i < simd_last; i += 4) {
+		// [xy0 info0 xy1 info1] [xy2 info2 xy3 info3] -> [xy0 xy1 xy2 xy3]
+		__m128i v0 = _mm_loadu_si128((const __m128i*) &packed[i]);
+		__m128i v1 = _mm_loadu_si128((const __m128i*) &packed[i + 2]);
+		__m128i a = _mm_shuffle_epi32(v0, _MM_SHUFFLE(3, 1, 2, 0));
+		__m128i b = _mm_shuffle_epi32(v1, _MM_SHUFFLE(3, 1, 2, 0));
+		__m128i xy = _mm_unpacklo_epi64(a, b);
+
+		__m128 x = _mm_cvtepi32_ps(_mm_and_si128(xy, low16));
+		__m128 y = _mm_cvtepi32_ps(_mm_srli_epi32(xy, 16));
+
+		__m128 dx = _mm_add_ps(base_x, _mm_mul_ps(x, step_x));
+		__m128 dy = _mm_add_ps(base_y, _mm_mul_ps(y, step_y));
+		__m128 d = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+
+		// second = min(second, max(best, d)) covers both the new-best and
+		// the new-second case.
+		__m128 closer = _mm_cmplt_ps(d, lane_best);
+		lane_second = _mm_min_ps(lane_second, _mm_max_ps(lane_best, d));
+		lane_best = _mm_min_ps(lane_best, d);
+
+		__m128i mask = _mm_castps_si128(closer);
+		lane_index = _mm_or_si128(_mm_and_si128(mask, cur), _mm_andnot_si128(mask, lane_index));
+		cur = _mm_add_epi32(cur, four);
+	}
+
+	float bests[4];
+	float seconds[4];
+	int indices[4];
+	_mm_storeu_ps(bests, lane_best);
+	_mm_storeu_ps(seconds, lane_second);
+	_mm_storeu_si128((__m128i*) indices, lane_index);
+
+	// Fold the lanes into the running result.
+	for (int k = 0; k < 4; k++) {
+		if (bests[k] < *best) {
+			*second = fminf(*best, seconds[k]);
+			*best = bests[k];
+			*index = indices[k];
+		} else {
+			*second = fminf(*second, bests[k]);
+		}
+	}
+
+	closest_in_range_packed_scalar(packed, bounds, simd_last, last, px, py, best, second, index);
+}
+
+#else
+
+void closest_in_range_packed(const PackedEntity* packed, const PackedBounds& bounds, int first, int last,
+							 float px, float py, float* best, float* second, int* index) {
+	closest_in_range_packed_scalar(packed, bounds, first, last, px, py, best, second, index);
+}
+
+#endif
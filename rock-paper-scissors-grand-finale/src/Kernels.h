@@ -0,0 +1,44 @@
+#pragma once
+
+#include <SDL.h>
+
+struct Entity;
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define KERNELS_SSE2 1
+#endif
+
+// 8-byte entity for bandwidth-bound scans: the position quantized to 16
+// bits per axis over PackedBounds, the type and index in the other 32 bits.
+struct PackedEntity {
+	Uint16 x;
+	Uint16 y;
+	Uint32 info;  // type << 24 | index
+};
+
+#define PACKED_INDEX_MASK 0xFFFFFF
+
+struct PackedBounds {
+	float x;
+	float y;
+	float step_x;  // world units per quantization step
+	float step_y;
+};
+
+// Quantizes entities over their bounding box.
+PackedBounds pack_entities(const Entity* entities, int count, PackedEntity* out);
+
+// Closest of entities [first, last) to (px, py). Tightens `best`/`second`
+// (squared distances) and sets `index` if something closer than `best`
+// is found.
+void closest_in_range(const Entity* entities, int first, int last, float px, float py,
+					  float* best, float* second, int* index);
+
+// Same over packed entities, decoding four at a time with SSE2 when
+// available.
+void closest_in_range_packed(const PackedEntity* packed, const PackedBounds& bounds, int first, int last,
+							 float px, float py, float* best, float* second, int* index);
+
+// Scalar version of the above, also the fallback without SSE2.
+void closest_in_range_packed_scalar(const PackedEntity* packed, const PackedBounds& bounds, int first, int last,
+									float px, float py, float* best, float* second, int* index);
@@ -0,0 +1,47 @@
+#include "MessageQueue.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void MessageQueue::Init(int _message_size, int _capacity) {
+	message_size = _message_size;
+	capacity = 1;
+	while (capacity < (Uint32)_capacity) {
+		capacity *= 2;
+	}
+	head = 0;
+	tail = 0;
+
+	data = (Uint8*) malloc(capacity * message_size);
+	if (!data) {
+		SDL_Log("Out of memory.");
+		exit(1);
+	}
+}
+
+void MessageQueue::Free() {
+	free(data);
+	data = nullptr;
+}
+
+bool MessageQueue::Push(const void* message) {
+	Uint32 t = tail.load(std::memory_order_relaxed);
+	if (t - head.load(std::memory_order_acquire) >= capacity) {
+		return false;
+	}
+
+	memcpy(data + (t & (capacity - 1)) * message_size, message, message_size);
+	tail.store(t + 1, std::memory_order_release);
+	return true;
+}
+
+bool MessageQueue::Pop(void* message) {
+	Uint32 h = head.load(std::memory_order_relaxed);
+	if (h == tail.load(std::memory_order_acquire)) {
+		return false;
+	}
+
+	memcpy(message, data + (h & (capacity - 1)) * message_size, message_size);
+	head.store(h + 1, std::memory_order_release);
+	return true;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <SDL.h>
+#include <atomic>
+
+// Single producer, single consumer ring of fixed-size messages. Never
+// blocks: Push fails when the ring is full, Pop when it's empty.
+struct MessageQueue {
+	Uint8* data;
+	int message_size;
+	Uint32 capacity;           // power of two
+	std::atomic<Uint32> head;  // next message to read, only the consumer writes it
+	std::atomic<Uint32> tail;  // next message to write, only the producer writes it
+
+	void Init(int _message_size, int _capacity);
+	void Free();
+
+	bool Push(const void* message);
+	bool Pop(void* message);
+};
@@ -0,0 +1,48 @@
+#include "Morton.h"
+
+#include <string.h>
+
+void radix_sort(Uint32* keys, int* values, Uint32* tmp_keys, int* tmp_values, int count) {
+	Uint32* src_keys = keys;
+	int* src_values = values;
+	Uint32* dst_keys = tmp_keys;
+	int* dst_values = tmp_values;
+
+	for (int shift = 0; shift < 32; shift += 8) {
+		int offsets[256] = {};
+		for (int i = 0; i < count; i++) {
+			offsets[(src_keys[i] >> shift) & 0xFF]++;
+		}
+
+		// Every key has the same digit, nothing to do this pass.
+		if (count > 0 && offsets[(src_keys[0] >> shift) & 0xFF] == count) {
+			continue;
+		}
+
+		int sum = 0;
+		for (int d = 0; d < 256; d++) {
+			int n = offsets[d];
+			offsets[d] = sum;
+			sum += n;
+		}
+
+		for (int i = 0; i < count; i++) {
+			int k = offsets[(src_keys[i] >> shift) & 0xFF]++;
+			dst_keys[k] = src_keys[i];
+			dst_values[k] = src_values[i];
+		}
+
+		Uint32* swap_keys = src_keys;
+		src_keys = dst_keys;
+		dst_keys = swap_keys;
+
+		int* swap_values = src_values;
+		src_values = dst_values;
+		dst_values = swap_values;
+	}
+
+	if (src_keys != keys) {
+		memcpy(keys, src_keys, count * sizeof(*keys));
+		memcpy(values, src_values, count * sizeof(*values));
+	}
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <SDL.h>
+
+// Interleaves the low 16 bits of x and y (x in the even bits) into a
+// Z-order curve key, so points close in space get close keys.
+static inline Uint32 morton_encode(Uint32 x, Uint32 y) {
+	x &= 0xFFFF;
+	x = (x | (x << 8)) & 0x00FF00FF;
+	x = (x | (x << 4)) & 0x0F0F0F0F;
+	x = (x | (x << 2)) & 0x33333333;
+	x = (x | (x << 1)) & 0x55555555;
+
+	y &= 0xFFFF;
+	y = (y | (y << 8)) & 0x00FF00FF;
+	y = (y | (y << 4)) & 0x0F0F0F0F;
+	y = (y | (y << 2)) & 0x33333333;
+	y = (y | (y << 1)) & 0x55555555;
+
+	return x | (y << 1);
+}
+
+// Stable LSD radix sort of `keys`, moving `values` along with them. The tmp
+// arrays must hold `count` elements each; the result ends up in keys/values.
+void radix_sort(Uint32* keys, int* values, Uint32* tmp_keys, int* tmp_values, int count);
@@ -0,0 +1,599 @@
+#include "Profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "imgui/imgui.h"
+
+const char* perf_counter_names[PERF_COUNTER_COUNT] = {
+	"cycles",
+	"instructions",
+	"cache_misses",
+	"branch_misses",
+};
+
+static thread_local int profiler_thread_index = -1;
+
+void Profiler::Init() {
+	thread_count = 0;
+	capturing = false;
+	flushing = false;
+	dropped_events = 0;
+	capture_frames = 0;
+	capture_frames_left = 0;
+	capture_start = 0;
+	capture_path[0] = 0;
+	flush_thread = nullptr;
+	hw_counters_available = 0;
+	hw_counters_logged = false;
+	display_frame = 0;
+
+	for (int i = 0; i < PROFILER_MAX_THREADS; i++) {
+		ProfilerThread* t = &threads[i];
+		t->name[0] = 0;
+		t->events = nullptr;
+		t->event_capacity = 0;
+		t->event_count = 0;
+		t->zone_count = 0;
+		t->counter_count = 0;
+		t->perf_state = 0;
+		for (int j = 0; j < PERF_COUNTER_COUNT; j++) {
+			t->perf_fd[j] = -1;
+			t->perf_slot[j] = -1;
+		}
+	}
+
+	RegisterThread("Main Thread");
+}
+
+static void write_trace(Profiler* p);
+
+void Profiler::Quit() {
+	if (capturing) {
+		// Quitting in the middle of a capture, keep what we have.
+		capturing = false;
+		capture_frames -= capture_frames_left;
+		capture_frames_left = 0;
+		write_trace(this);
+	}
+
+	if (flush_thread) {
+		SDL_WaitThread(flush_thread, nullptr);
+		flush_thread = nullptr;
+	}
+
+	for (int i = 0; i < PROFILER_MAX_THREADS; i++) {
+		ProfilerThread* t = &threads[i];
+		free(t->events);
+		t->events = nullptr;
+		t->event_capacity = 0;
+
+#ifdef __linux__
+		for (int j = 0; j < PERF_COUNTER_COUNT; j++) {
+			if (t->perf_fd[j] >= 0) close(t->perf_fd[j]);
+			t->perf_fd[j] = -1;
+		}
+#endif
+		t->perf_state = 0;
+	}
+}
+
+int Profiler::RegisterThread(const char* name) {
+	int index = thread_count.fetch_add(1);
+	if (index >= PROFILER_MAX_THREADS) {
+		SDL_Log("Profiler: too many threads, \"%s\" won't be recorded.", name);
+		thread_count = PROFILER_MAX_THREADS;
+		return -1;
+	}
+
+	ProfilerThread* t = &threads[index];
+	SDL_snprintf(t->name, sizeof(t->name), "%s", name);
+
+	profiler_thread_index = index;
+	return index;
+}
+
+static ProfileZoneStats* find_zone(ProfilerThread* t, const char* name) {
+	int count = t->zone_count.load(std::memory_order_relaxed);
+	for (int i = 0; i < count; i++) {
+		if (t->zones[i].name == name) {
+			return &t->zones[i];
+		}
+	}
+	for (int i = 0; i < count; i++) {
+		if (strcmp(t->zones[i].name, name) == 0) {
+			return &t->zones[i];
+		}
+	}
+
+	if (count >= PROFILER_MAX_ZONES) {
+		return nullptr;
+	}
+
+	ProfileZoneStats* z = &t->zones[count];
+	z->name = name;
+	z->calls = 0;
+	z->time = 0;
+	z->prev_calls = 0;
+	z->prev_time = 0;
+	z->display_calls = 0.0;
+	z->display_ms = 0.0;
+	for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+		z->counters[i] = 0;
+		z->prev_counters[i] = 0;
+		z->display_counters[i] = 0.0;
+	}
+	t->zone_count.store(count + 1, std::memory_order_release);
+	return z;
+}
+
+// Only the owning thread writes, so a relaxed load + store is enough.
+static void add_relaxed(std::atomic<Uint64>* a, Uint64 x) {
+	a->store(a->load(std::memory_order_relaxed) + x, std::memory_order_relaxed);
+}
+
+static ProfileCounter* find_counter(ProfilerThread* t, const char* name, bool ratio) {
+	int count = t->counter_count.load(std::memory_order_relaxed);
+	for (int i = 0; i < count; i++) {
+		if (t->counters[i].name == name || strcmp(t->counters[i].name, name) == 0) {
+			return &t->counters[i];
+		}
+	}
+
+	if (count >= PROFILER_MAX_COUNTERS) {
+		return nullptr;
+	}
+
+	ProfileCounter* c = &t->counters[count];
+	c->name = name;
+	c->ratio = ratio;
+	c->value = 0.0;
+	c->total = 0.0;
+	c->prev_value = 0.0;
+	c->prev_total = 0.0;
+	c->display = 0.0;
+	t->counter_count.store(count + 1, std::memory_order_release);
+	return c;
+}
+
+static void add_relaxed(std::atomic<double>* a, double x) {
+	a->store(a->load(std::memory_order_relaxed) + x, std::memory_order_relaxed);
+}
+
+void Profiler::Count(const char* name, double value) {
+	int index = profiler_thread_index;
+	if (index < 0) {
+		return;
+	}
+
+	if (ProfileCounter* c = find_counter(&threads[index], name, false)) {
+		add_relaxed(&c->value, value);
+	}
+}
+
+void Profiler::CountRatio(const char* name, double value, double total) {
+	int index = profiler_thread_index;
+	if (index < 0) {
+		return;
+	}
+
+	if (ProfileCounter* c = find_counter(&threads[index], name, true)) {
+		add_relaxed(&c->value, value);
+		add_relaxed(&c->total, total);
+	}
+}
+
+void Profiler::Record(const char* name, Uint64 begin, Uint64 end, const Uint64* counters) {
+	int index = profiler_thread_index;
+	if (index < 0) {
+		return;
+	}
+
+	ProfilerThread* t = &threads[index];
+
+	if (ProfileZoneStats* z = find_zone(t, name)) {
+		add_relaxed(&z->calls, 1);
+		add_relaxed(&z->time, end - begin);
+		if (counters) {
+			for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+				add_relaxed(&z->counters[i], counters[i]);
+			}
+		}
+	}
+
+	if (!capturing.load(std::memory_order_acquire)) {
+		return;
+	}
+
+	int i = t->event_count.load(std::memory_order_relaxed);
+	if (i >= t->event_capacity) {
+		dropped_events.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	ProfileEvent* ev = &t->events[i];
+	ev->name = name;
+	ev->begin = begin;
+	ev->end = end;
+
+	t->event_count.store(i + 1, std::memory_order_release);
+}
+
+bool Profiler::BeginCapture(int frames, const char* path) {
+	if (capturing || capture_frames_left > 0 || flushing) {
+		SDL_Log("Profiler: a capture is already in progress.");
+		return false;
+	}
+
+	if (flush_thread) {
+		SDL_WaitThread(flush_thread, nullptr);
+		flush_thread = nullptr;
+	}
+
+	if (frames <= 0) {
+		return false;
+	}
+
+	int capacity = frames * PROFILER_EVENTS_PER_FRAME;
+	int count = SDL_min(thread_count.load(), PROFILER_MAX_THREADS);
+	for (int i = 0; i < count; i++) {
+		ProfilerThread* t = &threads[i];
+		if (t->event_capacity < capacity) {
+			ProfileEvent* events = (ProfileEvent*) realloc(t->events, capacity * sizeof(ProfileEvent));
+			if (!events) {
+				SDL_Log("Profiler: out of memory for a %d frame capture.", frames);
+				return false;
+			}
+			t->events = events;
+			t->event_capacity = capacity;
+		}
+		t->event_count = 0;
+	}
+
+	SDL_snprintf(capture_path, sizeof(capture_path), "%s", path);
+	dropped_events = 0;
+	capture_frames = frames;
+	capture_frames_left = frames;
+
+	// The capture actually starts at the next frame boundary (see FrameEnd),
+	// so the first recorded frame is a whole one.
+	return true;
+}
+
+static void write_trace(Profiler* p) {
+	FILE* f = fopen(p->capture_path, "wb");
+	if (!f) {
+		SDL_Log("Profiler: couldn't open \"%s\" for writing.", p->capture_path);
+		return;
+	}
+
+	double to_us = 1'000'000.0 / (double)SDL_GetPerformanceFrequency();
+	int total = 0;
+
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"rock-paper-scissors-grand-finale\"}}");
+
+	int count = SDL_min(p->thread_count.load(), PROFILER_MAX_THREADS);
+	for (int i = 0; i < count; i++) {
+		ProfilerThread* t = &p->threads[i];
+
+		fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", i, t->name);
+
+		int event_count = t->event_count.load(std::memory_order_acquire);
+		for (int j = 0; j < event_count; j++) {
+			ProfileEvent* ev = &t->events[j];
+
+			if (ev->begin < p->capture_start) {
+				continue;
+			}
+
+			double ts = (double)(ev->begin - p->capture_start) * to_us;
+			double dur = (double)(ev->end - ev->begin) * to_us;
+			fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", ev->name, i, ts, dur);
+			total++;
+		}
+	}
+
+	fprintf(f, "\n]}\n");
+	fclose(f);
+
+	SDL_Log("Profiler: wrote %d events from %d frames to \"%s\" (%d dropped).",
+			total, p->capture_frames, p->capture_path, p->dropped_events.load());
+}
+
+static int flush_thread_proc(void* userdata) {
+	Profiler* p = (Profiler*) userdata;
+	write_trace(p);
+	p->flushing = false;
+	return 0;
+}
+
+static void update_display(Profiler* p, int frames) {
+	double to_ms = 1000.0 / (double)SDL_GetPerformanceFrequency();
+
+	int thread_count = SDL_min(p->thread_count.load(), PROFILER_MAX_THREADS);
+	for (int i = 0; i < thread_count; i++) {
+		ProfilerThread* t = &p->threads[i];
+
+		int zone_count = t->zone_count.load(std::memory_order_acquire);
+		for (int j = 0; j < zone_count; j++) {
+			ProfileZoneStats* z = &t->zones[j];
+
+			Uint64 calls = z->calls.load(std::memory_order_relaxed);
+			Uint64 time = z->time.load(std::memory_order_relaxed);
+
+			z->display_calls = (double)(calls - z->prev_calls) / (double)frames;
+			z->display_ms = (double)(time - z->prev_time) * to_ms / (double)frames;
+			z->prev_calls = calls;
+			z->prev_time = time;
+
+			for (int k = 0; k < PERF_COUNTER_COUNT; k++) {
+				Uint64 c = z->counters[k].load(std::memory_order_relaxed);
+				z->display_counters[k] = (double)(c - z->prev_counters[k]) / (double)frames;
+				z->prev_counters[k] = c;
+			}
+		}
+
+		int counter_count = t->counter_count.load(std::memory_order_acquire);
+		for (int j = 0; j < counter_count; j++) {
+			ProfileCounter* c = &t->counters[j];
+
+			double value = c->value.load(std::memory_order_relaxed);
+			double total = c->total.load(std::memory_order_relaxed);
+
+			if (c->ratio) {
+				double d = total - c->prev_total;
+				c->display = (d > 0.0) ? (value - c->prev_value) / d * 100.0 : 0.0;
+			} else {
+				c->display = (value - c->prev_value) / (double)frames;
+			}
+			c->prev_value = value;
+			c->prev_total = total;
+		}
+	}
+}
+
+void Profiler::FrameEnd() {
+	display_frame++;
+	if (display_frame >= PROFILER_DISPLAY_FRAMES) {
+		update_display(this, display_frame);
+		display_frame = 0;
+	}
+
+	if (capture_frames_left <= 0) {
+		return;
+	}
+
+	if (!capturing) {
+		capture_start = SDL_GetPerformanceCounter();
+		capturing.store(true, std::memory_order_release);
+		SDL_Log("Profiler: capturing %d frames...", capture_frames);
+		return;
+	}
+
+	capture_frames_left--;
+	if (capture_frames_left > 0) {
+		return;
+	}
+
+	capturing.store(false, std::memory_order_release);
+	flushing = true;
+
+	flush_thread = SDL_CreateThread(flush_thread_proc, "Trace Writer", this);
+	if (!flush_thread) {
+		// No threads (e.g. Emscripten without pthreads), write it here.
+		flush_thread_proc(this);
+	}
+}
+
+#ifdef __linux__
+
+static int perf_open(Uint64 config, int group_fd) {
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	// The times tell whether the PMU multiplexed the group.
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.disabled = (group_fd == -1);
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return (int) syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static bool perf_open_thread(Profiler* p, ProfilerThread* t) {
+	static const Uint64 configs[PERF_COUNTER_COUNT] = {
+		PERF_COUNT_HW_CPU_CYCLES,
+		PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_CACHE_MISSES,
+		PERF_COUNT_HW_BRANCH_MISSES,
+	};
+
+	int leader = perf_open(configs[0], -1);
+	if (leader < 0) {
+		// Every thread fails the same way.
+		if (!p->hw_counters_logged.exchange(true)) {
+			SDL_Log("Profiler: perf_event_open failed on \"%s\", hardware counters unavailable.", t->name);
+		}
+		return false;
+	}
+
+	int slots = 0;
+	int available = 0;
+	for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+		int fd = (i == 0) ? leader : perf_open(configs[i], leader);
+		if (fd < 0) {
+			continue;
+		}
+		t->perf_fd[i] = fd;
+		t->perf_slot[i] = slots++;
+		available |= 1 << i;
+	}
+
+	ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+	p->hw_counters_available.fetch_or(available);
+	return true;
+}
+
+bool Profiler::ReadCounters(Uint64* out) {
+	int index = profiler_thread_index;
+	if (index < 0) {
+		return false;
+	}
+
+	ProfilerThread* t = &threads[index];
+
+	if (t->perf_state == 0) {
+		t->perf_state = perf_open_thread(this, t) ? 1 : -1;
+	}
+	if (t->perf_state != 1) {
+		return false;
+	}
+
+	// nr, time_enabled, time_running, then one value per counter.
+	Uint64 buf[3 + PERF_COUNTER_COUNT];
+	if (read(t->perf_fd[PERF_CYCLES], buf, sizeof(buf)) < (ssize_t) (3 * sizeof(Uint64))) {
+		return false;
+	}
+
+	Uint64 enabled = buf[1];
+	Uint64 running = buf[2];
+	if (running == 0) {
+		return false;
+	}
+
+	// Multiplexed, the counts only cover `running`; scale them up the way
+	// perf stat does.
+	double scale = (running < enabled) ? (double)enabled / (double)running : 1.0;
+	for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+		int slot = t->perf_slot[i];
+		Uint64 value = (slot >= 0 && (Uint64)slot < buf[0]) ? buf[3 + slot] : 0;
+		out[i] = (scale == 1.0) ? value : (Uint64)((double)value * scale);
+	}
+	return true;
+}
+
+#else
+
+bool Profiler::ReadCounters(Uint64* out) {
+	(void) out;
+	return false;
+}
+
+#endif
+
+void Profiler::DrawOverlay(bool* open) {
+	if (!ImGui::Begin("Profiler", open)) {
+		ImGui::End();
+		return;
+	}
+
+	bool enabled = hw_counters;
+	if (ImGui::Checkbox("Hardware Counters", &enabled)) {
+		hw_counters = enabled;
+	}
+	int available = hw_counters_available;
+	if (enabled && available == 0) {
+		ImGui::SameLine();
+		ImGui::TextDisabled("(unavailable, timings only)");
+	}
+
+	bool show_counters = enabled && available != 0;
+	int columns = show_counters ? 3 + PERF_COUNTER_COUNT + 1 : 3;
+
+	int thread_count = SDL_min(this->thread_count.load(), PROFILER_MAX_THREADS);
+	for (int i = 0; i < thread_count; i++) {
+		ProfilerThread* t = &threads[i];
+
+		int zone_count = t->zone_count.load(std::memory_order_acquire);
+		int counter_count = t->counter_count.load(std::memory_order_acquire);
+		if (zone_count == 0 && counter_count == 0) {
+			continue;
+		}
+
+		if (!ImGui::CollapsingHeader(t->name, ImGuiTreeNodeFlags_DefaultOpen)) {
+			continue;
+		}
+
+		ImGui::PushID(i);
+		if (ImGui::BeginTable("zones", columns, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+			ImGui::TableSetupColumn("Zone");
+			ImGui::TableSetupColumn("ms/frame");
+			ImGui::TableSetupColumn("calls");
+			if (show_counters) {
+				ImGui::TableSetupColumn("cycles");
+				ImGui::TableSetupColumn("instr");
+				ImGui::TableSetupColumn("cache miss");
+				ImGui::TableSetupColumn("branch miss");
+				ImGui::TableSetupColumn("IPC");
+			}
+			ImGui::TableHeadersRow();
+
+			for (int j = 0; j < zone_count; j++) {
+				ProfileZoneStats* z = &t->zones[j];
+
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn(); ImGui::TextUnformatted(z->name);
+				ImGui::TableNextColumn(); ImGui::Text("%.3f", z->display_ms);
+				ImGui::TableNextColumn(); ImGui::Text("%.0f", z->display_calls);
+
+				if (show_counters) {
+					for (int k = 0; k < PERF_COUNTER_COUNT; k++) {
+						ImGui::TableNextColumn();
+						if (available & (1 << k)) {
+							ImGui::Text("%.3gM", z->display_counters[k] / 1'000'000.0);
+						} else {
+							ImGui::TextDisabled("n/a");
+						}
+					}
+
+					ImGui::TableNextColumn();
+					double cycles = z->display_counters[PERF_CYCLES];
+					if (cycles > 0.0) {
+						ImGui::Text("%.2f", z->display_counters[PERF_INSTRUCTIONS] / cycles);
+					} else {
+						ImGui::TextDisabled("-");
+					}
+				}
+			}
+
+			ImGui::EndTable();
+		}
+
+		if (counter_count > 0 && ImGui::BeginTable("counters", 2, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+			ImGui::TableSetupColumn("Counter");
+			ImGui::TableSetupColumn("per frame");
+			ImGui::TableHeadersRow();
+
+			for (int j = 0; j < counter_count; j++) {
+				ProfileCounter* c = &t->counters[j];
+
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn(); ImGui::TextUnformatted(c->name);
+				ImGui::TableNextColumn();
+				if (c->ratio) {
+					ImGui::Text("%.1f%%", c->display);
+				} else {
+					ImGui::Text("%.1f", c->display);
+				}
+			}
+
+			ImGui::EndTable();
+		}
+		ImGui::PopID();
+	}
+
+	ImGui::End();
+}
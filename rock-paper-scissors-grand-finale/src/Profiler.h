@@ -0,0 +1,161 @@
+#pragma once
+
+#include <SDL.h>
+#include <atomic>
+
+#define PROFILER_MAX_THREADS 32
+#define PROFILER_MAX_ZONES 32
+#define PROFILER_MAX_COUNTERS 16
+#define PROFILER_EVENTS_PER_FRAME 128
+#define PROFILER_DISPLAY_FRAMES 30
+
+// Hardware counters collected through perf_event_open on Linux.
+enum PerfCounter {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_CACHE_MISSES,
+	PERF_BRANCH_MISSES,
+
+	PERF_COUNTER_COUNT
+};
+
+extern const char* perf_counter_names[PERF_COUNTER_COUNT];
+
+// One finished timing zone. Times are raw SDL performance counter ticks.
+struct ProfileEvent {
+	const char* name;
+	Uint64 begin;
+	Uint64 end;
+};
+
+// Running totals for one zone name on one thread. The totals only grow and
+// have a single writer; the overlay reads them from the main thread.
+struct ProfileZoneStats {
+	const char* name;
+	std::atomic<Uint64> calls;
+	std::atomic<Uint64> time;
+	std::atomic<Uint64> counters[PERF_COUNTER_COUNT];
+
+	// Main thread only, refreshed every PROFILER_DISPLAY_FRAMES frames.
+	Uint64 prev_calls;
+	Uint64 prev_time;
+	Uint64 prev_counters[PERF_COUNTER_COUNT];
+	double display_calls;
+	double display_ms;
+	double display_counters[PERF_COUNTER_COUNT];
+};
+
+// Free-form per-frame statistic, e.g. cache hits. Ratio counters also sum a
+// denominator and are shown as a percentage.
+struct ProfileCounter {
+	const char* name;
+	bool ratio;
+	std::atomic<double> value;
+	std::atomic<double> total;
+
+	// Main thread only.
+	double prev_value;
+	double prev_total;
+	double display;
+};
+
+// Every thread that records zones owns one of these and is the only writer
+// to it, so recording never takes a lock.
+struct ProfilerThread {
+	char name[32];
+	ProfileEvent* events;
+	int event_capacity;
+	std::atomic<int> event_count;
+
+	ProfileZoneStats zones[PROFILER_MAX_ZONES];
+	std::atomic<int> zone_count;
+
+	ProfileCounter counters[PROFILER_MAX_COUNTERS];
+	std::atomic<int> counter_count;
+
+	// perf_event_open group: 0 = not opened yet, 1 = ok, -1 = unavailable.
+	int perf_state;
+	int perf_fd[PERF_COUNTER_COUNT];
+	int perf_slot[PERF_COUNTER_COUNT];
+};
+
+struct Profiler {
+	ProfilerThread threads[PROFILER_MAX_THREADS];
+	std::atomic<int> thread_count;
+
+	// Chrome trace capture.
+	std::atomic<bool> capturing;
+	std::atomic<bool> flushing;
+	std::atomic<int> dropped_events;
+	int capture_frames;
+	int capture_frames_left;
+	Uint64 capture_start;
+	char capture_path[256];
+	SDL_Thread* flush_thread;
+
+	// Per-zone hardware counters. Falls back to timings only when perf
+	// events can't be opened (not Linux, perf_event_paranoid, VMs...).
+	std::atomic<bool> hw_counters;
+	std::atomic<int> hw_counters_available; // bit per PerfCounter
+	std::atomic<bool> hw_counters_logged;   // the open failure, once
+	int display_frame;
+
+	void Init();
+	void Quit();
+
+	// Returns the thread index used as "tid" in the trace.
+	int RegisterThread(const char* name);
+
+	// Allocates all buffers up front; nothing is allocated or written to disk
+	// while the capture runs.
+	bool BeginCapture(int frames, const char* path);
+
+	// Called by the main thread once per frame.
+	void FrameEnd();
+
+	void Record(const char* name, Uint64 begin, Uint64 end, const Uint64* counters);
+
+	void Count(const char* name, double value);
+	void CountRatio(const char* name, double value, double total);
+
+	// Reads this thread's counters. Returns false if counters are off or
+	// unavailable on this thread.
+	bool ReadCounters(Uint64* out);
+
+	void DrawOverlay(bool* open);
+};
+
+struct ProfileZone {
+	Profiler* profiler;
+	const char* name;
+	Uint64 begin;
+	bool has_counters;
+	Uint64 counters[PERF_COUNTER_COUNT];
+
+	ProfileZone(Profiler* _profiler, const char* _name) {
+		profiler = _profiler;
+		name = _name;
+		has_counters = profiler->hw_counters.load(std::memory_order_relaxed) && profiler->ReadCounters(counters);
+		begin = SDL_GetPerformanceCounter();
+	}
+
+	~ProfileZone() {
+		Uint64 end = SDL_GetPerformanceCounter();
+		if (has_counters) {
+			Uint64 now[PERF_COUNTER_COUNT];
+			if (profiler->ReadCounters(now)) {
+				for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+					// Scaled counts of a multiplexed group can step back a little.
+					counters[i] = (now[i] > counters[i]) ? now[i] - counters[i] : 0;
+				}
+			} else {
+				has_counters = false;
+			}
+		}
+		profiler->Record(name, begin, end, has_counters ? counters : nullptr);
+	}
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_ZONE(profiler, name) ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(profiler, name)
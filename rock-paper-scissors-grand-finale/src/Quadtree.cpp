@@ -0,0 +1,448 @@
+#include "Quadtree.h"
+
+#include "Game.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int alloc_nodes(Quadtree* q, int n) {
+	if (q->node_count + n > q->node_capacity) {
+		int capacity = SDL_max(q->node_capacity * 2, q->node_count + n);
+		capacity = SDL_max(capacity, 64);
+		QuadtreeNode* nodes = (QuadtreeNode*) realloc(q->nodes, capacity * sizeof(QuadtreeNode));
+		if (!nodes) {
+			SDL_Log("Out of memory.");
+			exit(1);
+		}
+		q->nodes = nodes;
+		q->node_capacity = capacity;
+
+		QuadtreeSummary* summaries = (QuadtreeSummary*) realloc(q->summaries, capacity * 3 * sizeof(QuadtreeSummary));
+		if (!summaries) {
+			SDL_Log("Out of memory.");
+			exit(1);
+		}
+		q->summaries = summaries;
+	}
+
+	int first = q->node_count;
+	q->node_count += n;
+	return first;
+}
+
+// Moves items for which pred is true to the front, returns how many.
+template <typename F>
+static int partition(int* items, int count, F pred) {
+	int i = 0;
+	int j = count - 1;
+	for (;;) {
+		while (i <= j && pred(items[i])) i++;
+		while (i <= j && !pred(items[j])) j--;
+		if (i >= j) break;
+		int t = items[i];
+		items[i] = items[j];
+		items[j] = t;
+		i++;
+		j--;
+	}
+	return i;
+}
+
+static void summarize_leaf(Quadtree* q, const Entity* entities, int node, const int* items, int count) {
+	for (int t = 0; t < 3; t++) {
+		QuadtreeSummary* s = &q->summaries[node * 3 + t];
+		s->min_x = INFINITY;
+		s->min_y = INFINITY;
+		s->max_x = -INFINITY;
+		s->max_y = -INFINITY;
+		s->cx = 0.0f;
+		s->cy = 0.0f;
+		s->count = 0;
+		s->rep = -1;
+	}
+
+	for (int i = 0; i < count; i++) {
+		const Entity* e = &entities[items[i]];
+		QuadtreeSummary* s = &q->summaries[node * 3 + (int)e->type];
+		s->min_x = fminf(s->min_x, e->x);
+		s->min_y = fminf(s->min_y, e->y);
+		s->max_x = fmaxf(s->max_x, e->x);
+		s->max_y = fmaxf(s->max_y, e->y);
+		s->cx += e->x;
+		s->cy += e->y;
+		s->count++;
+	}
+
+	float rep_dist[3] = {INFINITY, INFINITY, INFINITY};
+	for (int t = 0; t < 3; t++) {
+		QuadtreeSummary* s = &q->summaries[node * 3 + t];
+		if (s->count > 0) {
+			s->cx /= (float)s->count;
+			s->cy /= (float)s->count;
+		}
+	}
+	for (int i = 0; i < count; i++) {
+		const Entity* e = &entities[items[i]];
+		int t = (int)e->type;
+		QuadtreeSummary* s = &q->summaries[node * 3 + t];
+		float dx = e->x - s->cx;
+		float dy = e->y - s->cy;
+		float d = dx * dx + dy * dy;
+		if (d < rep_dist[t]) {
+			rep_dist[t] = d;
+			s->rep = items[i];
+		}
+	}
+}
+
+static void summarize_children(Quadtree* q, const Entity* entities, int node) {
+	int first = q->nodes[node].first;
+
+	for (int t = 0; t < 3; t++) {
+		QuadtreeSummary* s = &q->summaries[node * 3 + t];
+		s->min_x = INFINITY;
+		s->min_y = INFINITY;
+		s->max_x = -INFINITY;
+		s->max_y = -INFINITY;
+		s->cx = 0.0f;
+		s->cy = 0.0f;
+		s->count = 0;
+		s->rep = -1;
+
+		for (int c = 0; c < 4; c++) {
+			const QuadtreeSummary* cs = &q->summaries[(first + c) * 3 + t];
+			if (cs->count == 0) continue;
+
+			s->min_x = fminf(s->min_x, cs->min_x);
+			s->min_y = fminf(s->min_y, cs->min_y);
+			s->max_x = fmaxf(s->max_x, cs->max_x);
+			s->max_y = fmaxf(s->max_y, cs->max_y);
+			s->cx += cs->cx * (float)cs->count;
+			s->cy += cs->cy * (float)cs->count;
+			s->count += cs->count;
+		}
+		if (s->count == 0) continue;
+
+		s->cx /= (float)s->count;
+		s->cy /= (float)s->count;
+
+		// The children's representatives are the candidates.
+		float best = INFINITY;
+		for (int c = 0; c < 4; c++) {
+			int rep = q->summaries[(first + c) * 3 + t].rep;
+			if (rep < 0) continue;
+
+			float dx = entities[rep].x - s->cx;
+			float dy = entities[rep].y - s->cy;
+			float d = dx * dx + dy * dy;
+			if (d < best) {
+				best = d;
+				s->rep = rep;
+			}
+		}
+	}
+}
+
+static void build_node(Quadtree* q, const Entity* entities, int node, int first, int count,
+					   float x0, float y0, float x1, float y1, int depth) {
+	int* items = q->items + first;
+
+	float min_x = INFINITY;
+	float min_y = INFINITY;
+	float max_x = -INFINITY;
+	float max_y = -INFINITY;
+	int types = 0;
+	for (int i = 0; i < count; i++) {
+		const Entity* e = &entities[items[i]];
+		if (e->x < min_x) min_x = e->x;
+		if (e->y < min_y) min_y = e->y;
+		if (e->x > max_x) max_x = e->x;
+		if (e->y > max_y) max_y = e->y;
+		types |= 1 << (int)e->type;
+	}
+
+	// Store bounds now, `q->nodes` may move when children get allocated.
+	{
+		QuadtreeNode* n = &q->nodes[node];
+		n->min_x = min_x;
+		n->min_y = min_y;
+		n->max_x = max_x;
+		n->max_y = max_y;
+		n->types = (Uint8) types;
+	}
+
+	if (count <= QUADTREE_LEAF_SIZE || depth >= QUADTREE_MAX_DEPTH) {
+		QuadtreeNode* n = &q->nodes[node];
+		n->first = first;
+		n->count = count;
+		n->leaf = true;
+		if (q->has_summaries) {
+			summarize_leaf(q, entities, node, items, count);
+		}
+		return;
+	}
+
+	float cx = (x0 + x1) * 0.5f;
+	float cy = (y0 + y1) * 0.5f;
+
+	int top = partition(items, count, [&](int i) { return entities[i].y < cy; });
+	int top_left = partition(items, top, [&](int i) { return entities[i].x < cx; });
+	int bottom_left = partition(items + top, count - top, [&](int i) { return entities[i].x < cx; });
+
+	int children = alloc_nodes(q, 4);
+	{
+		QuadtreeNode* n = &q->nodes[node];
+		n->first = children;
+		n->count = 0;
+		n->leaf = false;
+	}
+
+	build_node(q, entities, children + 0, first, top_left, x0, y0, cx, cy, depth + 1);
+	build_node(q, entities, children + 1, first + top_left, top - top_left, cx, y0, x1, cy, depth + 1);
+	build_node(q, entities, children + 2, first + top, bottom_left, x0, cy, cx, y1, depth + 1);
+	build_node(q, entities, children + 3, first + top + bottom_left, count - top - bottom_left, cx, cy, x1, y1, depth + 1);
+
+	if (q->has_summaries) {
+		summarize_children(q, entities, node);
+	}
+}
+
+void Quadtree::Build(const Entity* entities, int count, bool with_summaries) {
+	has_summaries = with_summaries;
+
+	if (count > item_capacity) {
+		free(items);
+		item_capacity = count;
+		items = (int*) malloc(item_capacity * sizeof(int));
+		if (!items) {
+			SDL_Log("Out of memory.");
+			exit(1);
+		}
+	}
+
+	float min_x = 0.0f;
+	float min_y = 0.0f;
+	float max_x = 0.0f;
+	float max_y = 0.0f;
+	for (int i = 0; i < count; i++) {
+		const Entity* e = &entities[i];
+		items[i] = i;
+		if (i == 0 || e->x < min_x) min_x = e->x;
+		if (i == 0 || e->y < min_y) min_y = e->y;
+		if (i == 0 || e->x > max_x) max_x = e->x;
+		if (i == 0 || e->y > max_y) max_y = e->y;
+	}
+
+	// Square root region so quadrants stay square.
+	float size = fmaxf(max_x - min_x, max_y - min_y) + 1.0f;
+
+	node_count = 0;
+	int root = alloc_nodes(this, 1);
+	build_node(this, entities, root, 0, count, min_x, min_y, min_x + size, min_y + size, 0);
+}
+
+void Quadtree::Free() {
+	free(nodes);
+	free(items);
+	free(summaries);
+	nodes = nullptr;
+	items = nullptr;
+	summaries = nullptr;
+	node_count = 0;
+	node_capacity = 0;
+	item_capacity = 0;
+}
+
+static float box_distance_sq(const QuadtreeNode* n, float px, float py) {
+	float dx = 0.0f;
+	float dy = 0.0f;
+	if (px < n->min_x) dx = n->min_x - px;
+	else if (px > n->max_x) dx = px - n->max_x;
+	if (py < n->min_y) dy = n->min_y - py;
+	else if (py > n->max_y) dy = py - n->max_y;
+	return dx * dx + dy * dy;
+}
+
+ClosestResult Quadtree::FindClosest(const Entity* entities, float px, float py, EntityType type, float radius) const {
+	int mask = 7 & ~(1 << (int)type);
+
+	int index = -1;
+	float best = radius * radius;
+	float second = best;
+
+	int stack[QUADTREE_MAX_DEPTH * 4 + 4];
+	int top = 0;
+	if (node_count > 0) {
+		stack[top++] = 0;
+	}
+
+	while (top > 0) {
+		const QuadtreeNode* n = &nodes[stack[--top]];
+
+		if (!(n->types & mask)) continue;
+		if (box_distance_sq(n, px, py) >= second) continue;
+
+		if (n->leaf) {
+			for (int k = n->first; k < n->first + n->count; k++) {
+				int j = items[k];
+				const Entity* e2 = &entities[j];
+				if (!((1 << (int)e2->type) & mask)) continue;
+
+				float dx = e2->x - px;
+				float dy = e2->y - py;
+				float d = dx * dx + dy * dy;
+				if (d < best) {
+					second = best;
+					best = d;
+					index = j;
+				} else if (d < second) {
+					second = d;
+				}
+			}
+			continue;
+		}
+
+		// Push the farthest child first so the nearest one is searched first.
+		int order[4];
+		float dist[4];
+		for (int c = 0; c < 4; c++) {
+			order[c] = n->first + c;
+			dist[c] = box_distance_sq(&nodes[order[c]], px, py);
+		}
+		for (int a = 1; a < 4; a++) {
+			for (int b = a; b > 0 && dist[b] > dist[b - 1]; b--) {
+				float td = dist[b]; dist[b] = dist[b - 1]; dist[b - 1] = td;
+				int to = order[b]; order[b] = order[b - 1]; order[b - 1] = to;
+			}
+		}
+		for (int c = 0; c < 4; c++) {
+			if (dist[c] < second && (nodes[order[c]].types & mask)) {
+				stack[top++] = order[c];
+			}
+		}
+	}
+
+	ClosestResult result;
+	result.index = index;
+	result.dist = (index >= 0) ? sqrtf(best) : radius;
+	result.second_dist = sqrtf(second);
+	result.complete = true;
+	return result;
+}
+
+ClosestResult Quadtree::FindClosestApprox(const Entity* entities, float px, float py, EntityType type, float radius, float theta) const {
+	struct Entry {
+		int node;
+		int mask;  // enemy types still worth looking at below this node
+	};
+
+	int index = -1;
+	float best = radius * radius;
+	float theta_sq = theta * theta;
+
+	Entry stack[QUADTREE_MAX_DEPTH * 4 + 4];
+	int top = 0;
+	if (node_count > 0) {
+		stack[top++] = {0, 7 & ~(1 << (int)type)};
+	}
+
+	while (top > 0) {
+		Entry entry = stack[--top];
+		const QuadtreeNode* n = &nodes[entry.node];
+
+		int mask = entry.mask & n->types;
+		if (!mask) continue;
+		if (box_distance_sq(n, px, py) >= best) continue;
+
+		if (n->leaf) {
+			for (int k = n->first; k < n->first + n->count; k++) {
+				int j = items[k];
+				const Entity* e2 = &entities[j];
+				if (!((1 << (int)e2->type) & mask)) continue;
+
+				float dx = e2->x - px;
+				float dy = e2->y - py;
+				float d = dx * dx + dy * dy;
+				if (d < best) {
+					best = d;
+					index = j;
+				}
+			}
+			continue;
+		}
+
+		for (int t = 0; t < 3; t++) {
+			if (!(mask & (1 << t))) continue;
+
+			const QuadtreeSummary* s = &summaries[entry.node * 3 + t];
+			float size = fmaxf(s->max_x - s->min_x, s->max_y - s->min_y);
+			float cx = s->cx - px;
+			float cy = s->cy - py;
+			if (size * size >= theta_sq * (cx * cx + cy * cy)) continue;
+
+			const Entity* e2 = &entities[s->rep];
+			float dx = e2->x - px;
+			float dy = e2->y - py;
+			float d = dx * dx + dy * dy;
+			if (d < best) {
+				best = d;
+				index = s->rep;
+			}
+			mask &= ~(1 << t);
+		}
+		if (!mask) continue;
+
+		int order[4];
+		float dist[4];
+		for (int c = 0; c < 4; c++) {
+			order[c] = n->first + c;
+			dist[c] = box_distance_sq(&nodes[order[c]], px, py);
+		}
+		for (int a = 1; a < 4; a++) {
+			for (int b = a; b > 0 && dist[b] > dist[b - 1]; b--) {
+				float td = dist[b]; dist[b] = dist[b - 1]; dist[b - 1] = td;
+				int to = order[b]; order[b] = order[b - 1]; order[b - 1] = to;
+			}
+		}
+		for (int c = 0; c < 4; c++) {
+			if (dist[c] < best && (nodes[order[c]].types & mask)) {
+				stack[top++] = {order[c], mask};
+			}
+		}
+	}
+
+	// Approximate, so there's no runner-up bound to cache against.
+	ClosestResult result;
+	result.index = index;
+	result.dist = (index >= 0) ? sqrtf(best) : radius;
+	result.second_dist = result.dist;
+	result.complete = true;
+	return result;
+}
+
+void Quadtree::ForEachNear(float px, float py, float radius, OverlapFn fn, void* user) const {
+	float radius_sq = radius * radius;
+
+	int stack[QUADTREE_MAX_DEPTH * 4 + 4];
+	int top = 0;
+	if (node_count > 0) {
+		stack[top++] = 0;
+	}
+
+	while (top > 0) {
+		const QuadtreeNode* n = &nodes[stack[--top]];
+		if (box_distance_sq(n, px, py) > radius_sq) continue;
+
+		if (n->leaf) {
+			for (int k = n->first; k < n->first + n->count; k++) {
+				fn(user, items[k]);
+			}
+			continue;
+		}
+
+		for (int c = 0; c < 4; c++) {
+			stack[top++] = n->first + c;
+		}
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <SDL.h>
+
+#include "SpatialGrid.h"
+
+#define QUADTREE_LEAF_SIZE 8
+#define QUADTREE_MAX_DEPTH 20
+
+// Children of a node are stored next to each other, `first` points at the
+// first one. Leaves point into `items` instead.
+struct QuadtreeNode {
+	float min_x;  // tight bounds of what's inside, not the quadrant
+	float min_y;
+	float max_x;
+	float max_y;
+	int first;
+	int count;    // items in a leaf, 0 for internal nodes
+	Uint8 types;  // bitmask of entity types in the subtree
+	bool leaf;
+};
+
+// What one entity type looks like from far away, for Barnes-Hut style
+// approximate queries.
+struct QuadtreeSummary {
+	float min_x;  // bounds of this type's entities in the subtree
+	float min_y;
+	float max_x;
+	float max_y;
+	float cx;     // centroid
+	float cy;
+	int count;
+	int rep;      // entity closest to the centroid, -1 if there are none
+};
+
+// Region quadtree rebuilt every tick. The per-node type masks let
+// nearest-enemy queries skip whole swarms of their own type.
+struct Quadtree {
+	QuadtreeNode* nodes;
+	int node_count;
+	int node_capacity;
+
+	int* items;
+	int item_capacity;
+
+	QuadtreeSummary* summaries;  // node * 3 + type, only if built with them
+	bool has_summaries;
+
+	void Build(const Entity* entities, int count, bool with_summaries);
+	void Free();
+
+	ClosestResult FindClosest(const Entity* entities, float px, float py, EntityType type, float radius) const;
+
+	// Takes a type's representative instead of descending once the type's
+	// bounds in a node are smaller than `theta` times their distance. 0 is
+	// exact, larger is faster and rougher. Needs summaries.
+	ClosestResult FindClosestApprox(const Entity* entities, float px, float py, EntityType type, float radius, float theta) const;
+
+	// Every entity in the leaves whose bounds are within `radius` of the
+	// point. Callers do the exact test.
+	void ForEachNear(float px, float py, float radius, OverlapFn fn, void* user) const;
+};
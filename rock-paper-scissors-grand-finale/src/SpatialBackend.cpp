@@ -0,0 +1,182 @@
+#include "SpatialBackend.h"
+
+#include "Game.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+static ClosestResult find_closest_brute_force(const Entity* entities, const int* type_start, EntityType type,
+											  float px, float py, float radius) {
+	int index = -1;
+	float best = radius * radius;
+	float second = best;
+
+	for (int t = 0; t < 3; t++) {
+		if (t == (int)type) continue;
+		closest_in_range(entities, type_start[t], type_start[t + 1], px, py, &best, &second, &index);
+	}
+
+	ClosestResult result;
+	result.index = index;
+	result.dist = (index >= 0) ? sqrtf(best) : radius;
+	result.second_dist = sqrtf(second);
+	result.complete = true;
+	return result;
+}
+
+static ClosestResult find_closest_packed(const PackedEntity* packed, const PackedBounds& bounds, const int* type_start,
+										 EntityType type, float px, float py, float radius) {
+	int index = -1;
+	float best = radius * radius;
+	float second = best;
+
+	for (int t = 0; t < 3; t++) {
+		if (t == (int)type) continue;
+		closest_in_range_packed(packed, bounds, type_start[t], type_start[t + 1], px, py, &best, &second, &index);
+	}
+
+	ClosestResult result;
+	result.index = index;
+	result.dist = (index >= 0) ? sqrtf(best) : radius;
+	result.second_dist = sqrtf(second);
+	result.complete = true;
+	return result;
+}
+
+// Nearest hit across the trees of the two other types. The second tree
+// starts from the first one's best distance, so it can stop early.
+static ClosestResult find_closest_kd_trees(const KdTree* trees, EntityType type, float px, float py, float radius) {
+	int index = -1;
+	float best = radius * radius;
+	float second = best;
+
+	for (int t = 0; t < 3; t++) {
+		if (t == (int)type) continue;
+		trees[t].FindClosest(px, py, &best, &second, &index);
+	}
+
+	ClosestResult result;
+	result.index = index;
+	result.dist = (index >= 0) ? sqrtf(best) : radius;
+	result.second_dist = sqrtf(second);
+	result.complete = true;
+	return result;
+}
+
+// With edges the map is the index's extent: same size every tick, nothing outside it.
+static const SDL_FRect* fixed_bounds(Game* game, SDL_FRect* bounds) {
+	if (game->boundary_mode == BoundaryMode::NONE) {
+		return nullptr;
+	}
+	*bounds = {0.0f, 0.0f, game->map_w, game->map_h};
+	return bounds;
+}
+
+static void brute_force_build(Game* game) {
+	if (!game->compact_entities) return;
+
+	if (game->entity_count > game->packed_capacity) {
+		free(game->packed);
+		game->packed_capacity = game->entity_count;
+		game->packed = (PackedEntity*) malloc(game->packed_capacity * sizeof(PackedEntity));
+		if (!game->packed) {
+			SDL_Log("Out of memory.");
+			exit(1);
+		}
+	}
+	game->packed_bounds = pack_entities(game->entities, game->entity_count, game->packed);
+}
+
+static ClosestResult brute_force_closest(Game* game, EntityType type, float px, float py, float radius, int) {
+	if (game->compact_entities) {
+		return find_closest_packed(game->packed, game->packed_bounds, game->type_start, type, px, py, radius);
+	}
+	return find_closest_brute_force(game->entities, game->type_start, type, px, py, radius);
+}
+
+static void grid_build(Game* game) {
+	SDL_FRect bounds;
+	game->grid.Build(game->entities, game->entity_count, game->grid_cell_size, fixed_bounds(game, &bounds));
+}
+
+static ClosestResult grid_closest(Game* game, EntityType type, float px, float py, float radius, int max_rings) {
+	return game->grid.FindClosest(game->entities, px, py, type, radius, max_rings);
+}
+
+static void grid_overlaps(Game* game, float px, float py, float radius, OverlapFn fn, void* user) {
+	game->grid.ForEachNear(px, py, radius, fn, user);
+}
+
+static void quadtree_build(Game* game) {
+	game->quadtree.Build(game->entities, game->entity_count, false);
+}
+
+static ClosestResult quadtree_closest(Game* game, EntityType type, float px, float py, float radius, int) {
+	return game->quadtree.FindClosest(game->entities, px, py, type, radius);
+}
+
+static void quadtree_overlaps(Game* game, float px, float py, float radius, OverlapFn fn, void* user) {
+	game->quadtree.ForEachNear(px, py, radius, fn, user);
+}
+
+static void kd_trees_build(Game* game) {
+	for (int i = 0; i < 3; i++) {
+		game->kd_trees[i].Build(game->entities, game->type_start[i], game->type_start[i + 1]);
+	}
+}
+
+static ClosestResult kd_trees_closest(Game* game, EntityType type, float px, float py, float radius, int) {
+	return find_closest_kd_trees(game->kd_trees, type, px, py, radius);
+}
+
+static void kd_trees_overlaps(Game* game, float px, float py, float radius, OverlapFn fn, void* user) {
+	for (int i = 0; i < 3; i++) {
+		game->kd_trees[i].ForEachNear(px, py, radius, fn, user);
+	}
+}
+
+static void flow_field_build(Game* game) {
+	SDL_FRect bounds;
+	game->flow_field.Build(game->entities, game->type_start, game->flow_cell_size, fixed_bounds(game, &bounds), &game->jobs);
+}
+
+static ClosestResult flow_field_closest(Game* game, EntityType type, float px, float py, float radius, int) {
+	return game->flow_field.FindClosest(game->entities, px, py, type, radius);
+}
+
+static void barnes_hut_build(Game* game) {
+	game->quadtree.Build(game->entities, game->entity_count, true);
+}
+
+static ClosestResult barnes_hut_closest(Game* game, EntityType type, float px, float py, float radius, int) {
+	return game->quadtree.FindClosestApprox(game->entities, px, py, type, radius, game->barnes_hut_theta);
+}
+
+void register_spatial_backends(Game* game) {
+	game->RegisterBackend(SpatialMode::BRUTE_FORCE, {
+		"Brute Force", false, true, LocalQuery::NONE,
+		brute_force_build, brute_force_closest, nullptr
+	});
+	game->RegisterBackend(SpatialMode::GRID, {
+		"Grid", false, true, LocalQuery::RINGS,
+		grid_build, grid_closest, grid_overlaps
+	});
+	game->RegisterBackend(SpatialMode::QUADTREE, {
+		"Quadtree", false, true, LocalQuery::RADIUS,
+		quadtree_build, quadtree_closest, quadtree_overlaps
+	});
+	game->RegisterBackend(SpatialMode::KD_TREE, {
+		"K-d Trees", false, true, LocalQuery::RADIUS,
+		kd_trees_build, kd_trees_closest, kd_trees_overlaps
+	});
+
+	// The flow field only knows sites, not entities, so collisions check everything.
+	game->RegisterBackend(SpatialMode::FLOW_FIELD, {
+		"Flow Field", true, false, LocalQuery::NONE,
+		flow_field_build, flow_field_closest, nullptr
+	});
+	game->RegisterBackend(SpatialMode::BARNES_HUT, {
+		"Barnes-Hut", true, false, LocalQuery::NONE,
+		barnes_hut_build, barnes_hut_closest, quadtree_overlaps
+	});
+}
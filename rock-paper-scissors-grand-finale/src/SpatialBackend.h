@@ -0,0 +1,31 @@
+#pragma once
+
+#include "SpatialGrid.h"
+
+struct Game;
+
+// How cheaply a backend can revalidate a cached target, see
+// Game::query_closest_local.
+enum struct LocalQuery {
+	NONE,    // only full queries
+	RINGS,   // a few rings of cells around the point
+	RADIUS,  // any search bounded by a finite radius
+};
+
+// One spatial index behind targeting and the collision broadphase. Game
+// keeps one per SpatialMode, filled in by register_spatial_backends.
+struct SpatialBackend {
+	const char* name;
+	bool approximate;  // queries don't give a bound the target cache can use
+	bool tunable;      // the auto-tuner may pick it
+	LocalQuery local;
+
+	void (*build)(Game* game);
+	// Only the grid honours `max_rings`, the rest always search all of `radius`.
+	ClosestResult (*closest)(Game* game, EntityType type, float px, float py, float radius, int max_rings);
+
+	// nullptr = no index to ask, every entity is a candidate.
+	void (*overlaps)(Game* game, float px, float py, float radius, OverlapFn fn, void* user);
+};
+
+void register_spatial_backends(Game* game);
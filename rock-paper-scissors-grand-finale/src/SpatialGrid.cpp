@@ -0,0 +1,219 @@
+#include "SpatialGrid.h"
+
+#include "Game.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GRID_MAX_CELLS (1 << 22)
+
+void SpatialGrid::Build(const Entity* entities, int count, float _cell_size, const SDL_FRect* bounds) {
+	float min_x = 0.0f;
+	float min_y = 0.0f;
+	float max_x = 0.0f;
+	float max_y = 0.0f;
+	if (bounds) {
+		min_x = bounds->x;
+		min_y = bounds->y;
+		max_x = bounds->x + bounds->w;
+		max_y = bounds->y + bounds->h;
+	} else {
+		if (count > 0) {
+			min_x = max_x = entities[0].x;
+			min_y = max_y = entities[0].y;
+		}
+		for (int i = 1; i < count; i++) {
+			const Entity* e = &entities[i];
+			if (e->x < min_x) min_x = e->x;
+			if (e->x > max_x) max_x = e->x;
+			if (e->y < min_y) min_y = e->y;
+			if (e->y > max_y) max_y = e->y;
+		}
+	}
+
+	cell_size = (_cell_size > 1.0f) ? _cell_size : 1.0f;
+
+	// Don't let a tiny cell size or a spread-out map blow up the cell count.
+	// Fixed bounds only depend on the map, so the size stays put for a run.
+	int max_cells = bounds ? GRID_MAX_CELLS : SDL_min(GRID_MAX_CELLS, count * 4 + 64);
+	for (;;) {
+		w = (int) ((max_x - min_x) / cell_size) + 1;
+		h = (int) ((max_y - min_y) / cell_size) + 1;
+		if ((Sint64)w * (Sint64)h <= max_cells) break;
+		cell_size *= 1.5f;
+	}
+
+	x = min_x;
+	y = min_y;
+	inv_cell_size = 1.0f / cell_size;
+
+	int cells = w * h;
+	int buckets = cells * 3;
+	if (buckets + 1 > cell_capacity) {
+		free(cell_start);
+		free(cell_types);
+		cell_capacity = buckets + 1;
+		cell_start = (int*) malloc(cell_capacity * sizeof(int));
+		cell_types = (Uint8*) malloc(cell_capacity * sizeof(Uint8));
+	}
+	if (count > item_capacity) {
+		free(items);
+		item_capacity = count;
+		items = (int*) malloc(item_capacity * sizeof(int));
+	}
+
+	if (!cell_start || !cell_types || !items) {
+		SDL_Log("Out of memory.");
+		exit(1);
+	}
+
+	memset(cell_start, 0, (buckets + 1) * sizeof(int));
+	memset(cell_types, 0, cells * sizeof(Uint8));
+
+	for (int i = 0; i < count; i++) {
+		const Entity* e = &entities[i];
+		int c = CellY(e->y) * w + CellX(e->x);
+		cell_start[c * 3 + (int)e->type]++;
+		cell_types[c] |= 1 << (int)e->type;
+	}
+
+	int sum = 0;
+	for (int b = 0; b < buckets; b++) {
+		int n = cell_start[b];
+		cell_start[b] = sum;
+		sum += n;
+	}
+	cell_start[buckets] = sum;
+
+	// Scatter, bumping each start to its end, then shift them back.
+	for (int i = 0; i < count; i++) {
+		const Entity* e = &entities[i];
+		int c = CellY(e->y) * w + CellX(e->x);
+		items[cell_start[c * 3 + (int)e->type]++] = i;
+	}
+	for (int b = buckets; b > 0; b--) {
+		cell_start[b] = cell_start[b - 1];
+	}
+	cell_start[0] = 0;
+}
+
+void SpatialGrid::Free() {
+	free(cell_start);
+	free(cell_types);
+	free(items);
+	cell_start = nullptr;
+	cell_types = nullptr;
+	items = nullptr;
+	cell_capacity = 0;
+	item_capacity = 0;
+}
+
+int SpatialGrid::CellX(float px) const {
+	int cx = (int) ((px - x) * inv_cell_size);
+	if (cx < 0) cx = 0;
+	if (cx >= w) cx = w - 1;
+	return cx;
+}
+
+int SpatialGrid::CellY(float py) const {
+	int cy = (int) ((py - y) * inv_cell_size);
+	if (cy < 0) cy = 0;
+	if (cy >= h) cy = h - 1;
+	return cy;
+}
+
+ClosestResult SpatialGrid::FindClosest(const Entity* entities, float px, float py, EntityType type,
+									   float radius, int max_rings) const {
+	int mask = 7 & ~(1 << (int)type);
+
+	int cx = CellX(px);
+	int cy = CellY(py);
+
+	// Distance from the point to the border of its own cell. Ring r can't be
+	// closer than (r - 1) cells plus this.
+	float x0 = x + (float)cx * cell_size;
+	float y0 = y + (float)cy * cell_size;
+	float edge = fminf(fminf(px - x0, x0 + cell_size - px), fminf(py - y0, y0 + cell_size - py));
+	if (edge < 0.0f) edge = 0.0f;
+
+	int index = -1;
+	float best = radius * radius;
+	float second = best;
+
+	int rings = SDL_max(w, h);
+	if (max_rings >= 0 && max_rings < rings) rings = max_rings;
+
+	float covered = INFINITY;
+	for (int r = 0; r <= SDL_max(w, h); r++) {
+		float lb = (r == 0) ? 0.0f : (float)(r - 1) * cell_size + edge;
+		if (lb * lb >= second) {
+			covered = lb;
+			break;
+		}
+		if (r > rings) {
+			covered = lb;
+			break;
+		}
+
+		for (int dy = -r; dy <= r; dy++) {
+			int yy = cy + dy;
+			if (yy < 0 || yy >= h) continue;
+
+			int step = (dy == -r || dy == r) ? 1 : 2 * r;
+			if (step == 0) step = 1;
+
+			for (int dx = -r; dx <= r; dx += step) {
+				int xx = cx + dx;
+				if (xx < 0 || xx >= w) continue;
+
+				int c = yy * w + xx;
+				if (!(cell_types[c] & mask)) continue;
+
+				for (int t = 0; t < 3; t++) {
+					if (t == (int)type) continue;
+
+					int b = c * 3 + t;
+					for (int k = cell_start[b]; k < cell_start[b + 1]; k++) {
+						int j = items[k];
+						const Entity* e2 = &entities[j];
+
+						float ddx = e2->x - px;
+						float ddy = e2->y - py;
+						float d = ddx * ddx + ddy * ddy;
+						if (d < best) {
+							second = best;
+							best = d;
+							index = j;
+						} else if (d < second) {
+							second = d;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	ClosestResult result;
+	result.index = index;
+	result.dist = (index >= 0) ? sqrtf(best) : radius;
+	result.second_dist = fminf(sqrtf(second), covered);
+	result.complete = (index >= 0) ? (result.dist <= covered) : (radius <= covered);
+	return result;
+}
+
+void SpatialGrid::ForEachNear(float px, float py, float radius, OverlapFn fn, void* user) const {
+	int x0 = CellX(px - radius);
+	int y0 = CellY(py - radius);
+	int x1 = CellX(px + radius);
+	int y1 = CellY(py + radius);
+
+	for (int yy = y0; yy <= y1; yy++) {
+		// A row of cells is one contiguous run of items, all types included.
+		int begin = cell_start[(yy * w + x0) * 3];
+		int end = cell_start[(yy * w + x1) * 3 + 3];
+		for (int k = begin; k < end; k++) {
+			fn(user, items[k]);
+		}
+	}
+}
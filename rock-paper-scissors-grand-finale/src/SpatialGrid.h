@@ -0,0 +1,51 @@
+#pragma once
+
+#include <SDL.h>
+
+struct Entity;
+enum struct EntityType;
+
+struct ClosestResult {
+	int index;          // -1 if nothing was found
+	float dist;
+	float second_dist;  // next closest candidate, or how far the search is known to be complete
+	bool complete;      // false if the search was cut short by max_rings
+};
+
+// Broadphase callback, gets every candidate entity index once.
+typedef void (*OverlapFn)(void* user, int index);
+
+// Uniform grid rebuilt every tick with a counting sort. Items are bucketed
+// by cell and then by type, so queries only walk the enemy buckets. Each
+// cell also keeps a bitmask of the types in it to skip same-type cells.
+struct SpatialGrid {
+	float x;
+	float y;
+	float cell_size;
+	float inv_cell_size;
+	int w;
+	int h;
+
+	int* cell_start;  // 3 * w * h + 1, indexed by cell * 3 + type
+	int* items;       // entity indices, sorted by cell and type
+	Uint8* cell_types;
+	int cell_capacity;
+	int item_capacity;
+
+	// Covers `bounds` if given (entities outside go to the border cells),
+	// otherwise the entities' bounding box.
+	void Build(const Entity* entities, int count, float _cell_size, const SDL_FRect* bounds);
+	void Free();
+
+	int CellX(float px) const;
+	int CellY(float py) const;
+
+	// Closest entity whose type isn't `type`, up to `radius` away. Only looks
+	// at rings of cells up to `max_rings` around the query point (-1 = all).
+	ClosestResult FindClosest(const Entity* entities, float px, float py, EntityType type,
+							  float radius, int max_rings) const;
+
+	// Every entity in the cells overlapping the square of half-size `radius`
+	// around the point. Callers do the exact test.
+	void ForEachNear(float px, float py, float radius, OverlapFn fn, void* user) const;
+};
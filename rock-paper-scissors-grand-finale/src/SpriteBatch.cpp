@@ -0,0 +1,155 @@
+#include "SpriteBatch.h"
+
+#include "Game.h"
+
+#include <stdlib.h>
+
+struct SpriteJob {
+	SpriteBatch* batch;
+	const Snapshot* snap;
+	float alpha;
+	float camera_x;
+	float camera_y;
+	float zoom;
+	float screen_w;
+	float screen_h;
+	float u0[3];  // atlas columns by EntityType
+	float u1[3];
+	float v1;
+};
+
+// Top left corner of entity i on screen, or false if its quad is off it.
+static bool sprite_corner(const SpriteJob* job, int i, float* x, float* y) {
+	const Snapshot* snap = job->snap;
+	const Entity* e = &snap->entities[i];
+	float size = 32.0f * job->zoom;
+	*x = (snap->prev[i * 2 + 0] + (e->x - snap->prev[i * 2 + 0]) * job->alpha - 16.0f - job->camera_x) * job->zoom;
+	*y = (snap->prev[i * 2 + 1] + (e->y - snap->prev[i * 2 + 1]) * job->alpha - 16.0f - job->camera_y) * job->zoom;
+	return *x + size > 0.0f && *y + size > 0.0f && *x < job->screen_w && *y < job->screen_h;
+}
+
+// ParallelFor hands out whole chunks, or everything at once when it runs
+// inline, so both passes walk their range a chunk at a time.
+static void count_job(void* user, int begin, int end) {
+	SpriteJob* job = (SpriteJob*) user;
+	for (int first = begin; first < end; first += SPRITE_BATCH_CHUNK) {
+		int last = SDL_min(first + SPRITE_BATCH_CHUNK, end);
+		int visible = 0;
+		for (int i = first; i < last; i++) {
+			float x;
+			float y;
+			visible += sprite_corner(job, i, &x, &y);
+		}
+		job->batch->chunk_offsets[first / SPRITE_BATCH_CHUNK] = visible;
+	}
+}
+
+static void fill_job(void* user, int begin, int end) {
+	SpriteJob* job = (SpriteJob*) user;
+	const Entity* entities = job->snap->entities;
+	float size = 32.0f * job->zoom;
+
+	for (int first = begin; first < end; first += SPRITE_BATCH_CHUNK) {
+		int last = SDL_min(first + SPRITE_BATCH_CHUNK, end);
+		SDL_Vertex* v = &job->batch->vertices[(size_t)job->batch->chunk_offsets[first / SPRITE_BATCH_CHUNK] * 4];
+		for (int i = first; i < last; i++) {
+			float x;
+			float y;
+			if (!sprite_corner(job, i, &x, &y)) continue;
+
+			int type = (int)entities[i].type;
+			float u0 = job->u0[type];
+			float u1 = job->u1[type];
+
+			v[0] = {{x,        y},        {255, 255, 255, 255}, {u0, 0.0f}};
+			v[1] = {{x + size, y},        {255, 255, 255, 255}, {u1, 0.0f}};
+			v[2] = {{x,        y + size}, {255, 255, 255, 255}, {u0, job->v1}};
+			v[3] = {{x + size, y + size}, {255, 255, 255, 255}, {u1, job->v1}};
+			v += 4;
+		}
+	}
+}
+
+void SpriteBatch::Draw(SDL_Renderer* renderer, JobSystem* jobs, SDL_Texture* atlas, const Snapshot* snap, float alpha,
+					   float camera_x, float camera_y, float zoom) {
+	int count = snap->entity_count;
+	if (count == 0) return;
+
+	if (count > quad_capacity) {
+		free(vertices);
+		free(indices);
+		quad_capacity = count;
+		vertices = (SDL_Vertex*) malloc((size_t)quad_capacity * 4 * sizeof(SDL_Vertex));
+		indices = (int*) malloc((size_t)quad_capacity * 6 * sizeof(int));
+		if (!vertices || !indices) {
+			SDL_Log("Out of memory.");
+			exit(1);
+		}
+
+		for (int q = 0; q < quad_capacity; q++) {
+			indices[q * 6 + 0] = q * 4 + 0;
+			indices[q * 6 + 1] = q * 4 + 1;
+			indices[q * 6 + 2] = q * 4 + 2;
+			indices[q * 6 + 3] = q * 4 + 2;
+			indices[q * 6 + 4] = q * 4 + 1;
+			indices[q * 6 + 5] = q * 4 + 3;
+		}
+	}
+
+	int chunk_count = (count + SPRITE_BATCH_CHUNK - 1) / SPRITE_BATCH_CHUNK;
+	if (chunk_count > chunk_capacity) {
+		free(chunk_offsets);
+		chunk_capacity = chunk_count;
+		chunk_offsets = (int*) malloc(chunk_capacity * sizeof(int));
+		if (!chunk_offsets) {
+			SDL_Log("Out of memory.");
+			exit(1);
+		}
+	}
+
+	int out_w;
+	int out_h;
+	SDL_GetRendererOutputSize(renderer, &out_w, &out_h);
+
+	// The atlas is one 32x32 sprite per EntityType, left to right.
+	int atlas_w = 96;
+	int atlas_h = 32;
+	SDL_QueryTexture(atlas, nullptr, nullptr, &atlas_w, &atlas_h);
+
+	SpriteJob job = {};
+	job.batch = this;
+	job.snap = snap;
+	job.alpha = alpha;
+	job.camera_x = camera_x;
+	job.camera_y = camera_y;
+	job.zoom = zoom;
+	job.screen_w = (float)out_w;
+	job.screen_h = (float)out_h;
+	for (int t = 0; t < 3; t++) {
+		job.u0[t] = (float)(t * 32) / (float)atlas_w;
+		job.u1[t] = (float)(t * 32 + 32) / (float)atlas_w;
+	}
+	job.v1 = 32.0f / (float)atlas_h;
+
+	jobs->ParallelFor("Sprite Count", count, SPRITE_BATCH_CHUNK, count_job, &job);
+
+	int quads = 0;
+	for (int c = 0; c < chunk_count; c++) {
+		int visible = chunk_offsets[c];
+		chunk_offsets[c] = quads;
+		quads += visible;
+	}
+
+	jobs->ParallelFor("Sprite Fill", count, SPRITE_BATCH_CHUNK, fill_job, &job);
+
+	if (quads > 0) {
+		SDL_RenderGeometry(renderer, atlas, vertices, quads * 4, indices, quads * 6);
+	}
+}
+
+void SpriteBatch::Free() {
+	free(vertices);
+	free(indices);
+	free(chunk_offsets);
+	*this = {};
+}
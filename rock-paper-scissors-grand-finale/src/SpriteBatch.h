@@ -0,0 +1,25 @@
+#pragma once
+
+#include <SDL.h>
+
+struct Snapshot;
+struct JobSystem;
+
+#define SPRITE_BATCH_CHUNK 16'384  // entities per job
+
+// Every visible entity as one textured quad, drawn with a single
+// SDL_RenderGeometry call. Jobs first count the visible entities in their
+// chunk, then write that chunk's quads at its offset in the shared vertex
+// buffer, so culling, the atlas lookup and the vertex fill all happen in
+// parallel. The buffers persist between frames and only ever grow.
+struct SpriteBatch {
+	SDL_Vertex* vertices;  // 4 per quad
+	int* indices;          // 6 per quad, the same for every frame
+	int quad_capacity;
+	int* chunk_offsets;    // first quad of each chunk
+	int chunk_capacity;
+
+	void Draw(SDL_Renderer* renderer, JobSystem* jobs, SDL_Texture* atlas, const Snapshot* snap, float alpha,
+			  float camera_x, float camera_y, float zoom);
+	void Free();
+};
@@ -0,0 +1,158 @@
+#include "TiledBruteForce.h"
+
+#include "Game.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+struct TileJob {
+	Game* game;
+	TiledBruteForce* tiles;
+	float reach;
+};
+
+static void push_pair(TileBlock* block, int i, int j) {
+	if (block->pair_count >= block->pair_capacity) {
+		int capacity = SDL_max(block->pair_capacity * 2, 1'024);
+		int* pairs = (int*) realloc(block->pairs, capacity * 2 * sizeof(int));
+		int* scratch = (int*) realloc(block->scratch, capacity * 2 * sizeof(int));
+		if (!pairs || !scratch) {
+			SDL_Log("Out of memory.");
+			exit(1);
+		}
+		block->pairs = pairs;
+		block->scratch = scratch;
+		block->pair_capacity = capacity;
+	}
+
+	block->pairs[block->pair_count * 2 + 0] = i;
+	block->pairs[block->pair_count * 2 + 1] = j;
+	block->pair_count++;
+}
+
+// Pairs come out grouped by candidate block; collisions want them in
+// query order, like the plain loop visits them.
+static void sort_pairs(TileBlock* block) {
+	int count[TILE_QUERY_SIZE + 1] = {};
+	for (int p = 0; p < block->pair_count; p++) {
+		count[block->pairs[p * 2] - block->first + 1]++;
+	}
+	for (int k = 0; k < TILE_QUERY_SIZE; k++) {
+		count[k + 1] += count[k];
+	}
+	for (int p = 0; p < block->pair_count; p++) {
+		int slot = count[block->pairs[p * 2] - block->first]++;
+		block->scratch[slot * 2 + 0] = block->pairs[p * 2 + 0];
+		block->scratch[slot * 2 + 1] = block->pairs[p * 2 + 1];
+	}
+
+	int* tmp = block->pairs;
+	block->pairs = block->scratch;
+	block->scratch = tmp;
+}
+
+static void tile_job(void* user, int begin, int end) {
+	TileJob* job = (TileJob*) user;
+	Game* game = job->game;
+	const Entity* entities = game->entities;
+	float reach_sq = job->reach * job->reach;
+	float radius = game->search_radius();
+
+	for (int b = begin; b < end; b++) {
+		TileBlock* block = &job->tiles->blocks[b];
+		int query_type = (int)entities[block->first].type;
+		int n = block->last - block->first;
+
+		float best[TILE_QUERY_SIZE];
+		int best_index[TILE_QUERY_SIZE];
+		for (int k = 0; k < n; k++) {
+			best[k] = radius * radius;
+			best_index[k] = -1;
+		}
+		block->pair_count = 0;
+
+		// Candidate blocks don't straddle types either, so whether they
+		// hold enemies is known per block.
+		for (int t = 0; t < 3; t++) {
+			bool enemies = (t != query_type);
+
+			for (int c = game->type_start[t]; c < game->type_start[t + 1]; c += TILE_CANDIDATE_SIZE) {
+				int c_end = SDL_min(c + TILE_CANDIDATE_SIZE, game->type_start[t + 1]);
+
+				for (int i = block->first; i < block->last; i++) {
+					const Entity* e = &entities[i];
+					float d_best = best[i - block->first];
+					int d_index = best_index[i - block->first];
+
+					for (int j = c; j < c_end; j++) {
+						float dx;
+						float dy;
+						game->offset(e->x, e->y, entities[j].x, entities[j].y, &dx, &dy);
+						float d = dx * dx + dy * dy;
+
+						if (enemies && d < d_best) {
+							d_best = d;
+							d_index = j;
+						}
+						if (d <= reach_sq && j != i) {
+							push_pair(block, i, j);
+						}
+					}
+
+					best[i - block->first] = d_best;
+					best_index[i - block->first] = d_index;
+				}
+			}
+		}
+
+		sort_pairs(block);
+
+		for (int k = 0; k < n; k++) {
+			EntityTarget* target = &game->targets[block->first + k];
+			target->handle = (best_index[k] >= 0) ? game->handles[best_index[k]] : 0;
+			target->dist = (best_index[k] >= 0) ? sqrtf(best[k]) : radius;
+			target->bound = -INFINITY;
+		}
+	}
+}
+
+void TiledBruteForce::Run(Game* game, float reach) {
+	int max_blocks = game->entity_count / TILE_QUERY_SIZE + 3;
+	if (max_blocks > block_capacity) {
+		TileBlock* new_blocks = (TileBlock*) realloc(blocks, max_blocks * sizeof(TileBlock));
+		if (!new_blocks) {
+			SDL_Log("Out of memory.");
+			exit(1);
+		}
+		for (int b = block_capacity; b < max_blocks; b++) {
+			new_blocks[b] = {};
+		}
+		blocks = new_blocks;
+		block_capacity = max_blocks;
+	}
+
+	block_count = 0;
+	for (int t = 0; t < 3; t++) {
+		for (int i = game->type_start[t]; i < game->type_start[t + 1]; i += TILE_QUERY_SIZE) {
+			TileBlock* block = &blocks[block_count++];
+			block->first = i;
+			block->last = SDL_min(i + TILE_QUERY_SIZE, game->type_start[t + 1]);
+		}
+	}
+
+	TileJob job = {game, this, reach};
+	game->jobs.ParallelFor("Tiled Scan", block_count, 1, tile_job, &job);
+	ready = true;
+}
+
+void TiledBruteForce::Free() {
+	for (int b = 0; b < block_capacity; b++) {
+		free(blocks[b].pairs);
+		free(blocks[b].scratch);
+	}
+	free(blocks);
+	blocks = nullptr;
+	block_count = 0;
+	block_capacity = 0;
+	ready = false;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <SDL.h>
+
+struct Game;
+
+#define TILE_QUERY_SIZE 256        // query entities per block
+#define TILE_CANDIDATE_SIZE 1'024  // 12 KB of entities, stays in L1 while a query block sweeps it
+
+// A run of query entities of one type, and the collision candidates found
+// for them, sorted by query entity.
+struct TileBlock {
+	int first;
+	int last;
+	int* pairs;    // query index, candidate index
+	int* scratch;  // same size as `pairs`, for sorting
+	int pair_count;
+	int pair_capacity;
+};
+
+// Cache-blocked brute force. Each block of query entities sweeps the whole
+// array one candidate block at a time, so a candidate block is read from
+// memory once per query block instead of once per entity. The same pass
+// finds every entity's target and the pairs close enough to collide after
+// this tick's movement.
+struct TiledBruteForce {
+	TileBlock* blocks;
+	int block_count;
+	int block_capacity;
+	bool ready;  // pairs are for the current positions and indices
+
+	// Sets every entity's target. `reach` is the collision distance plus
+	// the most anything can move before collisions are checked.
+	void Run(Game* game, float reach);
+	void Free();
+};
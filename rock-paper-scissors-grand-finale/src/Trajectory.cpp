@@ -0,0 +1,481 @@
+#include "Trajectory.h"
+
+#include "Game.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "misc.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif !defined(__EMSCRIPTEN__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TRAJECTORY_MMAP
+#endif
+
+#define TRAJECTORY_BUFFER_SIZE (4 * 1024 * 1024)
+
+int trajectory_put_varint(Uint8* p, Uint32 v) {
+	int n = 0;
+	while (v >= 0x80) {
+		p[n++] = (Uint8) (v | 0x80);
+		v >>= 7;
+	}
+	p[n++] = (Uint8) v;
+	return n;
+}
+
+// Returns the bytes read, 0 if the varint runs past `end` or is too long.
+int trajectory_get_varint(const Uint8* p, const Uint8* end, Uint32* v) {
+	Uint32 result = 0;
+	for (int n = 0; n < 5 && p + n < end; n++) {
+		result |= (Uint32) (p[n] & 0x7F) << (n * 7);
+		if (!(p[n] & 0x80)) {
+			*v = result;
+			return n + 1;
+		}
+	}
+	return 0;
+}
+
+static void write_bytes(TrajectoryWriter* w, const void* data, size_t size) {
+	const Uint8* src = (const Uint8*) data;
+	while (size > 0) {
+		size_t n = SDL_min(size, w->file.capacity - w->out_fill);
+		memcpy(w->out + w->out_fill, src, n);
+		w->out_fill += n;
+		w->offset += n;
+		src += n;
+		size -= n;
+
+		if (w->out_fill == w->file.capacity) {
+			w->file.Submit(w->out_fill);
+			w->out = w->file.Begin();
+			w->out_fill = 0;
+		}
+	}
+}
+
+bool TrajectoryWriter::Open(const char* _path, float map_w, float map_h) {
+	if (!file.Open(_path, TRAJECTORY_BUFFER_SIZE)) {
+		return false;
+	}
+
+	open = true;
+	SDL_strlcpy(path, _path, sizeof(path));
+	entity_count = 0;
+	need_keyframe = true;
+	out = file.Begin();
+	out_fill = 0;
+	frame_count = 0;
+	keyframe_count = 0;
+	offset = 0;
+	raw_bytes = 0;
+	start_time = GetTime();
+
+	TrajectoryHeader header = {};
+	header.magic = TRAJECTORY_MAGIC;
+	header.version = TRAJECTORY_VERSION;
+	header.quant = TRAJECTORY_QUANT;
+	header.map_w = map_w;
+	header.map_h = map_h;
+	header.keyframe_interval = TRAJECTORY_KEYFRAME_INTERVAL;
+	write_bytes(this, &header, sizeof(header));
+
+	return true;
+}
+
+void TrajectoryWriter::WriteFrame(Uint64 tick, const Entity* entities, const EntityHandle* handles, int count) {
+	if (!open) return;
+
+	// A new world needs a keyframe.
+	bool keyframe = need_keyframe || count != entity_count || frame_count % TRAJECTORY_KEYFRAME_INTERVAL == 0;
+	need_keyframe = false;
+
+	if (count > entity_count) {
+		free(last_q);
+		free(last_type);
+		free(cur_q);
+		free(cur_type);
+		free(frame);
+		last_q = (Sint32*) malloc(2 * count * sizeof(Sint32));
+		last_type = (Uint8*) malloc(count);
+		cur_q = (Sint32*) malloc(2 * count * sizeof(Sint32));
+		cur_type = (Uint8*) malloc(count);
+
+		// Worst case: two 5-byte varints and a type byte, or a conversion,
+		// per entity.
+		frame_capacity = 32 + (size_t)count * 16;
+		frame = (Uint8*) malloc(frame_capacity);
+		if (!last_q || !last_type || !cur_q || !cur_type || !frame) {
+			SDL_Log("Out of memory.");
+			exit(1);
+		}
+	}
+	entity_count = count;
+
+	for (int i = 0; i < count; i++) {
+		Uint32 slot = handles[i] & ENTITY_HANDLE_SLOT_MASK;
+		cur_q[slot * 2 + 0] = (Sint32) lroundf(entities[i].x * TRAJECTORY_QUANT);
+		cur_q[slot * 2 + 1] = (Sint32) lroundf(entities[i].y * TRAJECTORY_QUANT);
+		cur_type[slot] = (Uint8) entities[i].type;
+	}
+
+	Uint8* p = frame;
+	*p++ = keyframe ? TRAJECTORY_KEYFRAME : TRAJECTORY_DELTA;
+	p += trajectory_put_varint(p, (Uint32)tick);
+
+	if (keyframe) {
+		p += trajectory_put_varint(p, (Uint32)count);
+		for (int s = 0; s < count * 2; s++) {
+			p += trajectory_put_varint(p, zigzag(cur_q[s]));
+		}
+		memcpy(p, cur_type, count);
+		p += count;
+	} else {
+		for (int s = 0; s < count * 2; s++) {
+			p += trajectory_put_varint(p, zigzag(cur_q[s] - last_q[s]));
+		}
+
+		int conversions = 0;
+		for (int s = 0; s < count; s++) {
+			conversions += cur_type[s] != last_type[s];
+		}
+		p += trajectory_put_varint(p, (Uint32)conversions);
+		int prev = 0;
+		for (int s = 0; s < count; s++) {
+			if (cur_type[s] != last_type[s]) {
+				p += trajectory_put_varint(p, (Uint32)(s - prev));
+				*p++ = cur_type[s];
+				prev = s;
+			}
+		}
+	}
+
+	if (frame_count >= index_capacity) {
+		index_capacity = SDL_max(index_capacity * 2, 1'024);
+		index = (TrajectoryIndexEntry*) realloc(index, index_capacity * sizeof(TrajectoryIndexEntry));
+		if (!index) {
+			SDL_Log("Out of memory.");
+			exit(1);
+		}
+	}
+	index[frame_count].offset = offset;
+	index[frame_count].tick = (Uint32)tick;
+	index[frame_count].keyframe = keyframe;
+	frame_count++;
+	keyframe_count += keyframe;
+
+	write_bytes(this, frame, p - frame);
+	raw_bytes += (Uint64)count * sizeof(Entity);
+
+	Sint32* tq = last_q;
+	last_q = cur_q;
+	cur_q = tq;
+	Uint8* tt = last_type;
+	last_type = cur_type;
+	cur_type = tt;
+}
+
+void TrajectoryWriter::Close() {
+	if (!open) return;
+
+	TrajectoryFooter footer = {};
+	footer.index_offset = offset;
+	footer.frame_count = frame_count;
+	footer.magic = TRAJECTORY_INDEX_MAGIC;
+	write_bytes(this, index, frame_count * sizeof(TrajectoryIndexEntry));
+	write_bytes(this, &footer, sizeof(footer));
+
+	if (out_fill > 0) {
+		file.Submit(out_fill);
+	} else {
+		// Begin() took a buffer that won't be used; hand it back empty.
+		file.Submit(0);
+	}
+
+	double seconds = GetTime() - start_time;
+	double wait_time = file.wait_time;
+	Uint64 bytes = file.bytes;
+	if (!file.Close()) {
+		SDL_Log("Couldn't write \"%s\".", path);
+	}
+
+	SDL_Log("Recorded %d frames (%d keyframes) to \"%s\": %.2f MB, %.1fx smaller than raw snapshots, %.1f MB/s, %.1f ms waiting for the disk.",
+			frame_count, keyframe_count, path, (double)bytes / (1024.0 * 1024.0),
+			bytes > 0 ? (double)raw_bytes / (double)bytes : 0.0,
+			seconds > 0.0 ? (double)bytes / (1024.0 * 1024.0) / seconds : 0.0,
+			wait_time * 1000.0);
+
+	free(last_q);
+	free(last_type);
+	free(cur_q);
+	free(cur_type);
+	free(frame);
+	free(index);
+	open = false;
+	last_q = nullptr;
+	last_type = nullptr;
+	cur_q = nullptr;
+	cur_type = nullptr;
+	frame = nullptr;
+	index = nullptr;
+	entity_count = 0;
+	frame_capacity = 0;
+	index_capacity = 0;
+}
+
+// Maps `path` read-only. Returns null where that isn't available, and the
+// caller reads the file instead.
+static const Uint8* map_file(const char* path, size_t* size) {
+	const Uint8* data = nullptr;
+
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return nullptr;
+
+	LARGE_INTEGER file_size;
+	if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0) {
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping) {
+			data = (const Uint8*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			*size = (size_t)file_size.QuadPart;
+
+			// The view keeps the mapping alive.
+			CloseHandle(mapping);
+		}
+	}
+	CloseHandle(file);
+#elif defined(TRAJECTORY_MMAP)
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return nullptr;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) {
+			data = (const Uint8*) p;
+			*size = (size_t)st.st_size;
+		}
+	}
+	close(fd);
+#else
+	(void) path;
+	(void) size;
+#endif
+
+	return data;
+}
+
+static void unmap_file(const Uint8* data, size_t size) {
+#if defined(_WIN32)
+	(void) size;
+	UnmapViewOfFile(data);
+#elif defined(TRAJECTORY_MMAP)
+	munmap((void*) data, size);
+#else
+	(void) data;
+	(void) size;
+#endif
+}
+
+bool TrajectoryReader::Open(const char* path) {
+	Close();
+
+	data = map_file(path, &size);
+	mapped = data != nullptr;
+	if (!data) {
+		data = (const Uint8*) SDL_LoadFile(path, &size);
+		if (!data) {
+			SDL_Log("Couldn't open \"%s\": %s", path, SDL_GetError());
+			return false;
+		}
+	}
+
+	TrajectoryFooter footer;
+	bool ok = size >= sizeof(header) + sizeof(footer);
+	if (ok) {
+		memcpy(&header, data, sizeof(header));
+		memcpy(&footer, data + size - sizeof(footer), sizeof(footer));
+		ok = header.magic == TRAJECTORY_MAGIC
+			&& header.version == TRAJECTORY_VERSION
+			&& header.quant > 0.0f
+			&& footer.magic == TRAJECTORY_INDEX_MAGIC
+			&& footer.index_offset >= sizeof(header)
+			&& footer.index_offset <= size - sizeof(footer)
+			&& (size - sizeof(footer) - footer.index_offset) / sizeof(TrajectoryIndexEntry) == footer.frame_count
+			&& footer.frame_count > 0;
+	}
+	if (!ok) {
+		SDL_Log("\"%s\" isn't a trajectory file or wasn't closed properly.", path);
+		Close();
+		return false;
+	}
+
+	// The index isn't aligned in the file.
+	frame_count = (int)footer.frame_count;
+	index = (TrajectoryIndexEntry*) malloc(frame_count * sizeof(TrajectoryIndexEntry));
+	if (!index) {
+		SDL_Log("Out of memory.");
+		exit(1);
+	}
+	memcpy(index, data + footer.index_offset, frame_count * sizeof(TrajectoryIndexEntry));
+
+	// Decode trusts the offsets, so they have to point into the frames.
+	Uint64 prev_offset = sizeof(header);
+	for (int f = 0; f < frame_count; f++) {
+		if (index[f].offset < prev_offset || index[f].offset >= footer.index_offset) {
+			SDL_Log("\"%s\" has a damaged frame index.", path);
+			Close();
+			return false;
+		}
+		prev_offset = index[f].offset;
+	}
+
+	frames_end = data + footer.index_offset;
+	frame = -1;
+
+	SDL_Log("Opened \"%s\": %d frames, %.2f MB%s.", path, frame_count, (double)size / (1024.0 * 1024.0), mapped ? ", mapped" : "");
+	return true;
+}
+
+void TrajectoryReader::Close() {
+	if (data) {
+		if (mapped) {
+			unmap_file(data, size);
+		} else {
+			SDL_free((void*) data);
+		}
+	}
+	free(index);
+	free(q);
+	free(prev_q);
+	free(type);
+	data = nullptr;
+	size = 0;
+	mapped = false;
+	frames_end = nullptr;
+	index = nullptr;
+	frame_count = 0;
+	frame = -1;
+	entity_count = 0;
+	entity_capacity = 0;
+	q = nullptr;
+	prev_q = nullptr;
+	type = nullptr;
+}
+
+int TrajectoryReader::KeyframeBefore(int f) const {
+	while (f > 0 && !index[f].keyframe) {
+		f--;
+	}
+	return f;
+}
+
+bool TrajectoryReader::Decode(int f) {
+	if (f < 0 || f >= frame_count) return false;
+
+	const Uint8* p = data + index[f].offset;
+	const Uint8* end = frames_end;
+	bool sequential = f == frame + 1;
+
+	// Anything left half decoded has to start over from a keyframe.
+	frame = -1;
+
+	if (p >= end) return false;
+	Uint8 kind = *p++;
+
+	Uint32 v;
+	int n = trajectory_get_varint(p, end, &v);  // tick
+	if (n == 0) return false;
+	p += n;
+
+	if (kind == TRAJECTORY_KEYFRAME) {
+		Uint32 count;
+		n = trajectory_get_varint(p, end, &count);
+		if (n == 0) return false;
+		p += n;
+
+		// Each entity takes at least three bytes.
+		if (count > (size_t)(end - p) / 3) return false;
+
+		if ((int)count > entity_capacity) {
+			free(q);
+			free(prev_q);
+			free(type);
+			entity_capacity = (int)count;
+			q = (Sint32*) malloc(2 * count * sizeof(Sint32));
+			prev_q = (Sint32*) malloc(2 * count * sizeof(Sint32));
+			type = (Uint8*) malloc(count);
+			if (!q || !prev_q || !type) {
+				SDL_Log("Out of memory.");
+				exit(1);
+			}
+			sequential = false;
+		}
+
+		// A periodic keyframe in the middle of playback still moves smoothly.
+		sequential &= (int)count == entity_count;
+		if (sequential) {
+			Sint32* t = prev_q;
+			prev_q = q;
+			q = t;
+		}
+		entity_count = (int)count;
+
+		for (int s = 0; s < entity_count * 2; s++) {
+			n = trajectory_get_varint(p, end, &v);
+			if (n == 0) return false;
+			p += n;
+			q[s] = unzigzag(v);
+		}
+		if ((size_t)(end - p) < (size_t)entity_count) return false;
+		for (int s = 0; s < entity_count; s++) {
+			if (p[s] > (Uint8)EntityType::SCISSORS) return false;
+			type[s] = p[s];
+		}
+
+		if (!sequential) {
+			memcpy(prev_q, q, 2 * entity_count * sizeof(Sint32));
+		}
+	} else if (kind == TRAJECTORY_DELTA) {
+		if (!sequential) return false;
+
+		// The new frame goes where the one before last was.
+		for (int s = 0; s < entity_count * 2; s++) {
+			n = trajectory_get_varint(p, end, &v);
+			if (n == 0) return false;
+			p += n;
+			prev_q[s] = q[s] + unzigzag(v);
+		}
+		Sint32* t = prev_q;
+		prev_q = q;
+		q = t;
+
+		Uint32 conversions;
+		n = trajectory_get_varint(p, end, &conversions);
+		if (n == 0) return false;
+		p += n;
+
+		Uint32 s = 0;
+		for (Uint32 c = 0; c < conversions; c++) {
+			n = trajectory_get_varint(p, end, &v);
+			if (n == 0 || p + n >= end) return false;
+			p += n;
+			s += v;
+			if (s >= (Uint32)entity_count || *p > (Uint8)EntityType::SCISSORS) return false;
+			type[s] = *p++;
+		}
+	} else {
+		return false;
+	}
+
+	frame = f;
+	return true;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <SDL.h>
+
+#include "AsyncFileWriter.h"
+
+struct Entity;
+typedef Uint32 EntityHandle;
+
+// Trajectory file, little-endian:
+//
+//     TrajectoryHeader
+//     frames...
+//     TrajectoryIndexEntry[frame_count]
+//     TrajectoryFooter
+//
+// A frame is a kind byte, the tick as a varint, then:
+//
+//     keyframe: entity count, then per entity x and y as zigzag varints,
+//               then one type byte per entity.
+//     delta:    per entity the change in x and y since the previous frame as
+//               zigzag varints, then the number of conversions and, per
+//               conversion, the gap to the previous converted entity and
+//               its new type.
+//
+// Entities are stored by handle slot, which doesn't change when the
+// simulation reorders them. Positions are quantized to 1 / TRAJECTORY_QUANT
+// of a pixel and deltas are taken between quantized positions, so decoding
+// any number of them in a row doesn't drift.
+
+#define TRAJECTORY_MAGIC 0x4A525452u         // "RTRJ"
+#define TRAJECTORY_INDEX_MAGIC 0x58444E49u   // "INDX"
+#define TRAJECTORY_VERSION 1
+#define TRAJECTORY_QUANT 8.0f
+#define TRAJECTORY_KEYFRAME_INTERVAL 60
+
+#define TRAJECTORY_KEYFRAME 'K'
+#define TRAJECTORY_DELTA 'D'
+
+struct TrajectoryHeader {
+	Uint32 magic;
+	Uint32 version;
+	float quant;
+	float map_w;
+	float map_h;
+	Uint32 keyframe_interval;
+};
+
+struct TrajectoryIndexEntry {
+	Uint64 offset;
+	Uint32 tick;
+	Uint32 keyframe;
+};
+
+struct TrajectoryFooter {
+	Uint64 index_offset;
+	Uint32 frame_count;
+	Uint32 magic;
+};
+
+struct TrajectoryWriter {
+	AsyncFileWriter file;
+	bool open;
+	char path[256];
+
+	// The previous frame, by handle slot.
+	int entity_count;
+	bool need_keyframe;
+	Sint32* last_q;  // x and y
+	Uint8* last_type;
+	Sint32* cur_q;
+	Uint8* cur_type;
+
+	Uint8* frame;  // encoded frame before it's copied to the file
+	size_t frame_capacity;
+	Uint8* out;    // AsyncFileWriter buffer being filled
+	size_t out_fill;
+
+	TrajectoryIndexEntry* index;
+	int frame_count;
+	int keyframe_count;
+	int index_capacity;
+	Uint64 offset;
+
+	Uint64 raw_bytes;  // what full snapshots of the same frames would take
+	double start_time;
+
+	bool Open(const char* _path, float map_w, float map_h);
+	void WriteFrame(Uint64 tick, const Entity* entities, const EntityHandle* handles, int count);
+
+	// Writes the index and logs the compression ratio and bandwidth.
+	void Close();
+};
+
+// Reads a trajectory, mapped into memory where the platform allows and read
+// whole otherwise, and decodes frames into positions and types by slot.
+//
+//     reader.Decode(reader.KeyframeBefore(f));
+//     while (reader.frame < f) reader.Decode(reader.frame + 1);
+struct TrajectoryReader {
+	const Uint8* data;
+	size_t size;
+	bool mapped;         // false if `data` was read into memory
+	const Uint8* frames_end;
+	TrajectoryHeader header;
+	TrajectoryIndexEntry* index;
+	int frame_count;
+
+	// The last decoded frame, by handle slot.
+	int frame;           // -1 = none
+	int entity_count;
+	int entity_capacity;
+	Sint32* q;           // x and y
+	Sint32* prev_q;      // the frame before, the same as `q` after a jump
+	Uint8* type;
+
+	bool Open(const char* path);
+	void Close();
+
+	int KeyframeBefore(int f) const;
+
+	// Decodes frame `f`, which has to be a keyframe or the one after
+	// `frame`. Returns false if the file is damaged there.
+	bool Decode(int f);
+};
+
+int trajectory_put_varint(Uint8* p, Uint32 v);
+int trajectory_get_varint(const Uint8* p, const Uint8* end, Uint32* v);
+
+static inline Uint32 zigzag(Sint32 v) {
+	return ((Uint32)v << 1) ^ (Uint32)(v >> 31);
+}
+
+static inline Sint32 unzigzag(Uint32 v) {
+	return (Sint32)(v >> 1) ^ -(Sint32)(v & 1);
+}
@@ -0,0 +1,23 @@
+#include "TripleBuffer.h"
+
+void TripleBuffer::Init() {
+	front = 0;
+	middle = 1;
+	back = 2;
+}
+
+int TripleBuffer::Publish() {
+	int old = middle.exchange(back | TRIPLE_BUFFER_FRESH, std::memory_order_acq_rel);
+	back = old & ~TRIPLE_BUFFER_FRESH;
+	return back;
+}
+
+bool TripleBuffer::Acquire() {
+	if (!(middle.load(std::memory_order_relaxed) & TRIPLE_BUFFER_FRESH)) {
+		return false;
+	}
+
+	int old = middle.exchange(front, std::memory_order_acq_rel);
+	front = old & ~TRIPLE_BUFFER_FRESH;
+	return true;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <atomic>
+
+#define TRIPLE_BUFFER_FRESH 4
+
+// Lock-free triple buffer over three caller-owned slots. The writer always
+// has a slot of its own to fill and the reader always holds the newest
+// complete one; publishing and acquiring are a single exchange, so neither
+// side ever waits for the other. Stale slots are simply overwritten.
+struct TripleBuffer {
+	std::atomic<int> middle;  // slot index, | TRIPLE_BUFFER_FRESH if not read yet
+	int back;                 // writer only
+	int front;                // reader only
+
+	void Init();
+
+	// Writer: hands `back` over and returns the slot to fill next.
+	int Publish();
+
+	// Reader: moves `front` to the newest published slot. Returns false if
+	// nothing was published since the last call.
+	bool Acquire();
+};
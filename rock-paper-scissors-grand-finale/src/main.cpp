@@ -1,9 +1,86 @@
 #include "Game.h"
+#include "Benchmark.h"
+#include "Export.h"
+#include "EventLog.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+static void parse_args(Game* game, BenchmarkOptions* bench, ExportOptions* video, EventsToCsvOptions* csv, int argc, char* argv[]) {
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+			game->trace_on_start_frames = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--trace-file") == 0 && i + 1 < argc) {
+			game->trace_path = argv[++i];
+		} else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+			SDL_strlcpy(game->record_path, argv[++i], sizeof(game->record_path));
+			game->record_on_start = true;
+		} else if (strcmp(argv[i], "--log-conversions") == 0 && i + 1 < argc) {
+			SDL_strlcpy(game->event_log_path, argv[++i], sizeof(game->event_log_path));
+			game->event_log_on_start = true;
+		} else if (strcmp(argv[i], "--view") == 0 && i + 1 < argc) {
+			game->view_path = argv[++i];
+		} else if (strcmp(argv[i], "--perf-counters") == 0) {
+			game->profiler.hw_counters = true;
+			bench->hw_counters = true;
+		} else if (strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc) {
+			bench->path = argv[++i];
+		} else if (strcmp(argv[i], "--bench-entities") == 0 && i + 1 < argc) {
+			bench->entity_count = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--bench-ticks") == 0 && i + 1 < argc) {
+			bench->ticks = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--bench-query-ticks") == 0 && i + 1 < argc) {
+			bench->query_ticks = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--bench-layout-queries") == 0 && i + 1 < argc) {
+			bench->layout_queries = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--bench-crossover-ticks") == 0 && i + 1 < argc) {
+			bench->crossover_ticks = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--export") == 0 && i + 1 < argc) {
+			video->path = argv[++i];
+		} else if (strcmp(argv[i], "--export-entities") == 0 && i + 1 < argc) {
+			video->entity_count = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--export-ticks") == 0 && i + 1 < argc) {
+			video->ticks = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--export-every") == 0 && i + 1 < argc) {
+			video->every = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--export-width") == 0 && i + 1 < argc) {
+			video->width = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--export-height") == 0 && i + 1 < argc) {
+			video->height = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--export-fps") == 0 && i + 1 < argc) {
+			video->fps = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--export-density") == 0) {
+			video->density = true;
+		} else if (strcmp(argv[i], "--events-to-csv") == 0 && i + 2 < argc) {
+			csv->log_path = argv[++i];
+			csv->csv_path = argv[++i];
+		} else {
+			SDL_Log("Unknown argument \"%s\".", argv[i]);
+		}
+	}
+}
 
 #ifndef __EMSCRIPTEN__
 
 int main(int argc, char* argv[]) {
 	Game game{};
+	BenchmarkOptions bench{};
+	ExportOptions video{};
+	EventsToCsvOptions csv{};
+
+	parse_args(&game, &bench, &video, &csv, argc, argv);
+
+	if (bench.path) {
+		return RunBenchmark(bench);
+	}
+
+	if (video.path) {
+		return RunExport(video);
+	}
+
+	if (csv.log_path) {
+		return RunEventsToCsv(csv);
+	}
 
 	game.Init();
 	game.Run();
@@ -26,6 +103,11 @@ int main(int argc, char* argv[]) {
 	Game game{};
 	g = &game;
 
+	BenchmarkOptions bench{};
+	ExportOptions video{};
+	EventsToCsvOptions csv{};
+	parse_args(&game, &bench, &video, &csv, argc, argv);
+
 	game.Init();
 	emscripten_set_main_loop(emscripten_main_loop, 60, 1);
 	game.Quit();
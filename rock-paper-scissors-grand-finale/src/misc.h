@@ -13,6 +13,7 @@ static void stop_sound(Mix_Chunk* chunk) {
 }
 
 static void play_sound(Mix_Chunk* chunk) {
+	if (!chunk) return;
 	stop_sound(chunk);
 	Mix_PlayChannel(-1, chunk, 0);
 }